@@ -0,0 +1,421 @@
+/*
+
+  axis_encoders.c - driver code for ESP32
+
+  Linear or rotary axis encoders for lost step detection
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if AXIS_ENCODERS_ENABLE
+
+#include <math.h>
+#include <string.h>
+
+#include "esp_timer.h"
+
+#include "axis_encoders.h"
+#include "pcnt_encoder.h"
+
+#if USE_I2S_OUT
+#include "i2s_out.h"
+#endif
+
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+#include "grbl/motion_control.h"
+#include "grbl/nvs_buffer.h"
+
+#ifndef AXIS_ENCODER_FILTER
+#define AXIS_ENCODER_FILTER 40 // APB clock cycles, 0.5 us
+#endif
+
+// The commanded position is the step count maintained by the stepper interrupt, the measured
+// position is referenced to it at startup and on homing completion. The difference is checked
+// at a fixed rate from the foreground and added to the real time report as |FE:.
+// When stepping via I2S the step count leads the motors by the bitstream latency, the measured
+// position is then compared to the commanded position interpolated from the samples kept.
+
+#ifndef AXIS_ENCODER_HISTORY
+#define AXIS_ENCODER_HISTORY 8 // commanded position samples, must cover the I2S latency at the check rate
+#endif
+
+typedef enum {
+    FollowingError_Off = 0,
+    FollowingError_Warning,
+    FollowingError_Alarm
+} following_error_action_t;
+
+typedef struct {
+    float limit;    // mm
+    uint8_t action; // following_error_action_t
+} axis_encoder_settings_t;
+
+typedef struct {
+    uint8_t axis;
+    uint8_t pin_a;
+    uint8_t pin_b;
+    float resolution; // counts per mm
+} axis_encoder_cfg_t;
+
+typedef struct {
+    pcnt_encoder_t counter;
+    const axis_encoder_cfg_t *cfg;
+    float offset;       // commanded - measured position at last sync, mm
+    float error;        // following error, mm
+    float error_max;    // max. absolute following error since last sync, mm
+} axis_encoder_t;
+
+static const axis_encoder_cfg_t encoder_cfg[] = {
+#ifdef X_ENCODER_A_PIN
+  #ifndef X_ENCODER_RESOLUTION
+  #error "X_ENCODER_RESOLUTION must be defined when X_ENCODER_A_PIN is!"
+  #endif
+    { .axis = X_AXIS, .pin_a = X_ENCODER_A_PIN, .pin_b = X_ENCODER_B_PIN, .resolution = X_ENCODER_RESOLUTION },
+#endif
+#ifdef Y_ENCODER_A_PIN
+  #ifndef Y_ENCODER_RESOLUTION
+  #error "Y_ENCODER_RESOLUTION must be defined when Y_ENCODER_A_PIN is!"
+  #endif
+    { .axis = Y_AXIS, .pin_a = Y_ENCODER_A_PIN, .pin_b = Y_ENCODER_B_PIN, .resolution = Y_ENCODER_RESOLUTION },
+#endif
+#ifdef Z_ENCODER_A_PIN
+  #ifndef Z_ENCODER_RESOLUTION
+  #error "Z_ENCODER_RESOLUTION must be defined when Z_ENCODER_A_PIN is!"
+  #endif
+    { .axis = Z_AXIS, .pin_a = Z_ENCODER_A_PIN, .pin_b = Z_ENCODER_B_PIN, .resolution = Z_ENCODER_RESOLUTION },
+#endif
+#if defined(A_ENCODER_A_PIN) && N_AXIS > 3
+  #ifndef A_ENCODER_RESOLUTION
+  #error "A_ENCODER_RESOLUTION must be defined when A_ENCODER_A_PIN is!"
+  #endif
+    { .axis = A_AXIS, .pin_a = A_ENCODER_A_PIN, .pin_b = A_ENCODER_B_PIN, .resolution = A_ENCODER_RESOLUTION },
+#endif
+#if defined(B_ENCODER_A_PIN) && N_AXIS > 4
+  #ifndef B_ENCODER_RESOLUTION
+  #error "B_ENCODER_RESOLUTION must be defined when B_ENCODER_A_PIN is!"
+  #endif
+    { .axis = B_AXIS, .pin_a = B_ENCODER_A_PIN, .pin_b = B_ENCODER_B_PIN, .resolution = B_ENCODER_RESOLUTION },
+#endif
+#if defined(C_ENCODER_A_PIN) && N_AXIS > 5
+  #ifndef C_ENCODER_RESOLUTION
+  #error "C_ENCODER_RESOLUTION must be defined when C_ENCODER_A_PIN is!"
+  #endif
+    { .axis = C_AXIS, .pin_a = C_ENCODER_A_PIN, .pin_b = C_ENCODER_B_PIN, .resolution = C_ENCODER_RESOLUTION },
+#endif
+};
+
+#define N_ENCODERS (sizeof(encoder_cfg) / sizeof(axis_encoder_cfg_t))
+
+_Static_assert(AXIS_ENCODER_PCNT_UNIT_BASE + N_ENCODERS <= PCNT_UNIT_MAX, "Not enough PCNT units for the axis encoders, check AXIS_ENCODER_PCNT_UNIT_BASE!");
+
+typedef struct {
+    int64_t time;
+    float position[N_ENCODERS]; // commanded position, mm
+} commanded_sample_t;
+
+static uint_fast8_t n_encoders = 0;
+static axis_encoder_t encoder[N_ENCODERS];
+static bool limit_exceeded = false, synced = false;
+static int64_t next_check = 0;
+static uint_fast8_t history_head = 0, history_count = 0;
+static commanded_sample_t history[AXIS_ENCODER_HISTORY];
+static nvs_address_t nvs_address;
+static axis_encoder_settings_t encoder_settings;
+static on_execute_realtime_ptr on_execute_realtime;
+static on_realtime_report_ptr on_realtime_report;
+static on_homing_completed_ptr on_homing_completed;
+static on_report_options_ptr on_report_options;
+
+static const setting_detail_t encoder_settings_list[] = {
+    { Setting_FollowingErrorLimit, Group_Stepper, "Axis encoder following error limit", "mm", Format_Decimal, "##0.000", NULL, NULL, Setting_NonCore, &encoder_settings.limit, NULL, NULL },
+    { Setting_FollowingErrorAction, Group_Stepper, "Axis encoder following error action", NULL, Format_RadioButtons, "Off,Warning,Alarm", NULL, NULL, Setting_NonCore, &encoder_settings.action, NULL, NULL }
+};
+
+#ifndef NO_SETTINGS_DESCRIPTIONS
+
+static const setting_descr_t encoder_settings_descr[] = {
+    { Setting_FollowingErrorLimit, "Maximum allowed difference between the commanded and the encoder measured axis position." },
+    { Setting_FollowingErrorAction, "Action taken when the following error limit is exceeded.\\n"
+                                    "The alarm aborts motion, rehoming is needed to resynchronize the encoders."
+    }
+};
+
+#endif
+
+static void encoder_settings_save (void)
+{
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&encoder_settings, sizeof(axis_encoder_settings_t), true);
+}
+
+static void encoder_settings_restore (void)
+{
+    encoder_settings.limit = AXIS_ENCODER_FOLLOWING_ERROR;
+    encoder_settings.action = FollowingError_Alarm;
+
+    encoder_settings_save();
+}
+
+static void encoder_settings_load (void)
+{
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&encoder_settings, nvs_address, sizeof(axis_encoder_settings_t), true) != NVS_TransferResult_OK)
+        encoder_settings_restore();
+}
+
+static setting_details_t setting_details = {
+    .settings = encoder_settings_list,
+    .n_settings = sizeof(encoder_settings_list) / sizeof(setting_detail_t),
+#ifndef NO_SETTINGS_DESCRIPTIONS
+    .descriptions = encoder_settings_descr,
+    .n_descriptions = sizeof(encoder_settings_descr) / sizeof(setting_descr_t),
+#endif
+    .save = encoder_settings_save,
+    .load = encoder_settings_load,
+    .restore = encoder_settings_restore
+};
+
+static inline float commanded_position (axis_encoder_t *enc)
+{
+    return (float)sys.position[enc->cfg->axis] / settings.axis[enc->cfg->axis].steps_per_mm;
+}
+
+static inline float measured_position (axis_encoder_t *enc)
+{
+    return (float)pcnt_encoder_get_count(&enc->counter) / enc->cfg->resolution;
+}
+
+// Returns the time the motors lag the step count.
+static inline uint32_t output_latency (void)
+{
+#if USE_I2S_OUT
+    return i2s_out_get_pulser_status() == PASSTHROUGH ? 0 : i2s_out_get_latency_us();
+#else
+    return 0;
+#endif
+}
+
+// Samples the commanded positions and gets the positions at the time the motors are at,
+// returns false if not enough samples are available to cover the output latency.
+static bool commanded_positions (int64_t now, float *position)
+{
+    uint_fast8_t idx, sample, newer, older;
+    int64_t time = now - output_latency();
+
+    for(idx = 0; idx < n_encoders; idx++)
+        history[history_head].position[idx] = commanded_position(&encoder[idx]);
+    history[history_head].time = now;
+
+    newer = history_head;
+    history_head = (history_head + 1) % AXIS_ENCODER_HISTORY;
+    if(history_count < AXIS_ENCODER_HISTORY)
+        history_count++;
+
+    // Find the samples taken before and after the output time, newest first.
+    for(sample = 1; sample < history_count && history[newer].time > time; sample++) {
+        older = (newer + AXIS_ENCODER_HISTORY - 1) % AXIS_ENCODER_HISTORY;
+        if(history[older].time <= time) {
+            float f = (float)(time - history[older].time) / (float)(history[newer].time - history[older].time);
+            for(idx = 0; idx < n_encoders; idx++)
+                position[idx] = history[older].position[idx] + (history[newer].position[idx] - history[older].position[idx]) * f;
+            return true;
+        }
+        newer = older;
+    }
+
+    if(history[newer].time > time)
+        return false;
+
+    memcpy(position, history[newer].position, sizeof(float) * n_encoders);
+
+    return true;
+}
+
+static void axis_encoders_sync (void)
+{
+    uint_fast8_t idx;
+
+    history_count = 0;
+
+    for(idx = 0; idx < n_encoders; idx++) {
+        encoder[idx].offset = commanded_position(&encoder[idx]) - measured_position(&encoder[idx]);
+        encoder[idx].error = encoder[idx].error_max = 0.0f;
+    }
+
+    limit_exceeded = false;
+    synced = true;
+}
+
+static void axis_encoders_check (sys_state_t state)
+{
+    int64_t now = esp_timer_get_time();
+
+    on_execute_realtime(state);
+
+    if(now < next_check)
+        return;
+
+    next_check = now + AXIS_ENCODER_INTERVAL_MS * 1000;
+
+    if(state == STATE_HOMING)
+        return;
+
+    // Reference the encoders on the first check, settings are not available on init.
+    if(!synced) {
+        axis_encoders_sync();
+        return;
+    }
+
+    uint_fast8_t idx;
+    bool exceeded = false, recovered = true;
+    float position[N_ENCODERS];
+
+    if(!commanded_positions(now, position))
+        return;
+
+    for(idx = 0; idx < n_encoders; idx++) {
+        encoder[idx].error = position[idx] - measured_position(&encoder[idx]) - encoder[idx].offset;
+        encoder[idx].error_max = max(encoder[idx].error_max, fabsf(encoder[idx].error));
+        exceeded |= fabsf(encoder[idx].error) > encoder_settings.limit;
+        recovered &= fabsf(encoder[idx].error) < encoder_settings.limit * 0.5f;
+    }
+
+    if(encoder_settings.action == FollowingError_Off || encoder_settings.limit <= 0.0f)
+        return;
+
+    if(exceeded && !limit_exceeded) {
+        limit_exceeded = true;
+        if(encoder_settings.action == FollowingError_Alarm && state != STATE_ALARM && state != STATE_ESTOP) {
+            mc_reset();
+            system_set_exec_alarm(Alarm_MotorFault);
+        } else
+            report_message("Axis encoder following error limit exceeded", Message_Warning);
+    } else if(limit_exceeded && recovered)
+        limit_exceeded = false;
+}
+
+static void onRealtimeReport (stream_write_ptr stream_write, report_tracking_flags_t report)
+{
+    uint_fast8_t idx, axis;
+    float error[N_AXIS] = {0};
+
+    for(idx = 0; idx < n_encoders; idx++)
+        error[encoder[idx].cfg->axis] = encoder[idx].error;
+
+    stream_write("|FE:");
+    for(axis = 0; axis < N_AXIS; axis++) {
+        if(axis)
+            stream_write(",");
+        stream_write(ftoa(error[axis], N_DECIMAL_COORDVALUE_MM));
+    }
+
+    if(on_realtime_report)
+        on_realtime_report(stream_write, report);
+}
+
+static void onHomingCompleted (axes_signals_t homing_cycle, bool success)
+{
+    if(on_homing_completed)
+        on_homing_completed(homing_cycle, success);
+
+    if(success)
+        axis_encoders_sync();
+}
+
+static void onReportOptions (bool newopt)
+{
+    on_report_options(newopt);
+
+    if(!newopt) {
+        hal.stream.write("[PLUGIN:Axis encoders v0.01]" ASCII_EOL);
+    }
+}
+
+// $AXISENC reports axis, measured position, following error and max following error, =S to resynchronize.
+static status_code_t axis_encoders_command (sys_state_t state, char *args)
+{
+    uint_fast8_t idx;
+
+    if(args) {
+        if(!(*args == 'S' && args[1] == '\0'))
+            return Status_InvalidStatement;
+        axis_encoders_sync();
+    }
+
+    for(idx = 0; idx < n_encoders; idx++) {
+        hal.stream.write("[AXISENC:");
+        hal.stream.write(axis_letter[encoder[idx].cfg->axis]);
+        hal.stream.write(",");
+        hal.stream.write(ftoa(measured_position(&encoder[idx]) + encoder[idx].offset, N_DECIMAL_COORDVALUE_MM));
+        hal.stream.write(",");
+        hal.stream.write(ftoa(encoder[idx].error, N_DECIMAL_COORDVALUE_MM));
+        hal.stream.write(",");
+        hal.stream.write(ftoa(encoder[idx].error_max, N_DECIMAL_COORDVALUE_MM));
+        hal.stream.write("]" ASCII_EOL);
+    }
+
+    return Status_OK;
+}
+
+bool axis_encoders_init (void)
+{
+    uint_fast8_t idx;
+
+    static const sys_command_t encoder_command_list[] = {
+        {"AXISENC", axis_encoders_command, { .allow_blocking = On }, { .str = "report axis encoder positions and following errors, =S to resynchronize" } }
+    };
+
+    static sys_commands_t encoder_commands = {
+        .n_commands = sizeof(encoder_command_list) / sizeof(sys_command_t),
+        .commands = encoder_command_list
+    };
+
+    for(idx = 0; idx < N_ENCODERS; idx++) {
+        if(pcnt_encoder_init(&encoder[n_encoders].counter, AXIS_ENCODER_PCNT_UNIT_BASE + idx, encoder_cfg[idx].pin_a, encoder_cfg[idx].pin_b, AXIS_ENCODER_FILTER)) {
+            encoder[n_encoders].cfg = &encoder_cfg[idx];
+            n_encoders++;
+        }
+    }
+
+    if(n_encoders < N_ENCODERS)
+        protocol_enqueue_foreground_task(report_warning, "Failed to initialize axis encoder(s)");
+
+    if(n_encoders == 0 || !(nvs_address = nvs_alloc(sizeof(axis_encoder_settings_t))))
+        return false;
+
+    settings_register(&setting_details);
+    system_register_commands(&encoder_commands);
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = axis_encoders_check;
+
+    on_realtime_report = grbl.on_realtime_report;
+    grbl.on_realtime_report = onRealtimeReport;
+
+    on_homing_completed = grbl.on_homing_completed;
+    grbl.on_homing_completed = onHomingCompleted;
+
+    on_report_options = grbl.on_report_options;
+    grbl.on_report_options = onReportOptions;
+
+    return true;
+}
+
+#endif // AXIS_ENCODERS_ENABLE
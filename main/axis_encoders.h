@@ -0,0 +1,49 @@
+/*
+
+  axis_encoders.h - driver code for ESP32
+
+  Linear or rotary axis encoders for lost step detection
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _AXIS_ENCODERS_H_
+#define _AXIS_ENCODERS_H_
+
+#include "driver.h"
+
+// Encoder inputs are defined in the board map by <axis>_ENCODER_A_PIN and <axis>_ENCODER_B_PIN,
+// the resolution by <axis>_ENCODER_RESOLUTION in counts per mm (or degree), all four edges are counted.
+// Use a negative resolution if the encoder counts down when the axis moves in the positive direction.
+
+#ifndef AXIS_ENCODER_PCNT_UNIT_BASE
+#define AXIS_ENCODER_PCNT_UNIT_BASE PCNT_UNIT_2 // PCNT units are assigned in axis order from this, the ESP32-S3 has 4 units
+#endif
+
+#ifndef AXIS_ENCODER_INTERVAL_MS
+#define AXIS_ENCODER_INTERVAL_MS 10             // following error check rate
+#endif
+
+#ifndef AXIS_ENCODER_FOLLOWING_ERROR
+#define AXIS_ENCODER_FOLLOWING_ERROR 0.5f       // default following error limit, mm
+#endif
+
+bool axis_encoders_init (void);
+
+#endif
@@ -49,6 +49,8 @@
 #include "grbl/nvs_buffer.h"
 #include "grbl/protocol.h"
 
+#include "stream_buffer.h"
+
 #define SPP_RUNNING      (1 << 0)
 #define SPP_CONNECTED    (1 << 1)
 #define SPP_CONGESTED    (1 << 2)
@@ -56,17 +58,6 @@
 #define BT_TX_QUEUE_ENTRIES 32
 #define BT_TX_BUFFER_SIZE 250
 
-#define USE_BT_MUTEX 0
-
-#if USE_BT_MUTEX
-#define BT_MUTEX_LOCK()   do {} while (xSemaphoreTake(lock, portMAX_DELAY) != pdPASS)
-#define BT_MUTEX_UNLOCK() xSemaphoreGive(lock)
-static SemaphoreHandle_t lock = NULL;
-#else
-#define BT_MUTEX_LOCK()
-#define BT_MUTEX_UNLOCK()
-#endif
-
 #define SPP_TAG "BLUETOOTH"
 
 typedef struct {
@@ -123,36 +114,17 @@ static enqueue_realtime_command_ptr BTSetRtHandler (enqueue_realtime_command_ptr
 
 uint32_t BTStreamAvailable (void)
 {
-    uint16_t head = rxbuffer.head, tail = rxbuffer.tail;
-
-    return BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+    return rx_buffer_count(&rxbuffer);
 }
 
 uint16_t BTStreamRXFree (void)
 {
-    uint16_t head = rxbuffer.head, tail = rxbuffer.tail;
-
-    return (RX_BUFFER_SIZE - 1) - BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+    return rx_buffer_free(&rxbuffer);
 }
 
 int16_t BTStreamGetC (void)
 {
-    BT_MUTEX_LOCK();
-
-    int16_t data;
-    uint16_t bptr = rxbuffer.tail;
-
-    if(bptr == rxbuffer.head) {
-        BT_MUTEX_UNLOCK();
-        return -1; // no data available else EOF
-    }
-
-    data = rxbuffer.data[bptr++];                 // Get next character, increment tmp pointer
-    rxbuffer.tail = bptr & (RX_BUFFER_SIZE - 1);  // and update pointer
-
-    BT_MUTEX_UNLOCK();
-
-    return data;
+    return rx_buffer_getc(&rxbuffer);
 }
 
 static inline bool enqueue_tx_chunk (uint16_t length, uint8_t *data)
@@ -195,22 +167,12 @@ void BTStreamWriteS (const char *data)
 
 void BTStreamFlush (void)
 {
-    BT_MUTEX_LOCK();
-
-    rxbuffer.tail = rxbuffer.head;
-
-    BT_MUTEX_UNLOCK();
+    rx_buffer_flush(&rxbuffer);
 }
 
 IRAM_ATTR void BTStreamCancel (void)
 {
-    BT_MUTEX_LOCK();
-
-    rxbuffer.data[rxbuffer.head] = ASCII_CAN;
-    rxbuffer.tail = rxbuffer.head;
-    rxbuffer.head = (rxbuffer.tail + 1) & (RX_BUFFER_SIZE - 1);
-
-    BT_MUTEX_UNLOCK();
+    rx_buffer_cancel(&rxbuffer);
 }
 
 char *bluetooth_get_device_mac (void)
@@ -343,28 +305,10 @@ static void esp_spp_cb (esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
             }
             break;
 
-        case ESP_SPP_DATA_IND_EVT:;
-            char c;
-            uint16_t len = param->data_ind.len;
-            uint8_t *data = param->data_ind.data;
-
-            while(len--) {
-                c = (char)*data++;
-                // discard input if MPG has taken over...
-                if(hal.stream.type != StreamType_MPG) {
-                    if(!enqueue_realtime_command(c)) {
-
-                        uint32_t bptr = (rxbuffer.head + 1) & (RX_BUFFER_SIZE - 1);  // Get next head pointer
-
-                        if(bptr == rxbuffer.tail)               // If buffer full
-                            rxbuffer.overflow = 1;              // flag overflow,
-                        else {
-                            rxbuffer.data[rxbuffer.head] = c;   // else add data to buffer
-                            rxbuffer.head = bptr;               // and update pointer
-                        }
-                    }
-                }
-            }
+        case ESP_SPP_DATA_IND_EVT:
+            // discard input if MPG has taken over...
+            if(hal.stream.type != StreamType_MPG)
+                rx_buffer_enqueue(&rxbuffer, param->data_ind.data, param->data_ind.len, enqueue_realtime_command);
             break;
 
         case ESP_SPP_CONG_EVT:
@@ -493,11 +437,6 @@ bool bluetooth_start_local (void)
     xEventGroupClearBits(event_group, 0xFFFFFF);
     xEventGroupSetBits(event_group, SPP_CONGESTED);
 
-#if USE_BT_MUTEX
-    if(!(lock || (lock = xSemaphoreCreateMutex())))
-        return false;
-#endif
-
     if(!(tx_queue || (tx_queue = xQueueCreate(BT_TX_QUEUE_ENTRIES, sizeof(tx_chunk_t *)))))
         return false;
 
@@ -616,10 +555,6 @@ bool bluetooth_disable_local (void)
             vSemaphoreDelete(tx_busy);
             vQueueDelete(tx_queue);
             polltask = event_group = tx_busy = tx_queue = NULL;
-#if USE_BT_MUTEX
-            vSemaphoreDelete(lock);
-            lock = NULL;
-#endif
         }
     }
 
@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
 #include <math.h>
@@ -39,6 +40,8 @@
 #include "esp_log.h"
 #include "sdkconfig.h"
 #include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "soc/rtc.h"
 #include "driver/gpio.h"
 #include "driver/timer.h"
@@ -104,6 +107,18 @@
 #include "i2c.h"
 #endif
 
+#if SPINDLE_ENCODER_ENABLE
+#include "pcnt_encoder.h"
+#endif
+
+#if HANDWHEEL_ENABLE
+#include "handwheel.h"
+#endif
+
+#if AXIS_ENCODERS_ENABLE
+#include "axis_encoders.h"
+#endif
+
 #if DRIVER_SPINDLE_ENABLE
 
 static spindle_id_t spindle_id = -1;
@@ -114,6 +129,28 @@ static uint32_t pwm_max_value;
 static bool pwmEnabled = false;
 static spindle_pwm_t spindle_pwm;
 
+#if SPINDLE_PWM_LUT_SIZE
+
+// RPM to PWM lookup table, sampled from the core PWM computation (including any linearization
+// set up by the spindle settings) over the RPM range at equidistant points and interpolated
+// between them. Positions are in 24.8 fixed point.
+
+#define SPINDLE_PWM_LUT_FRAC_BITS 8
+
+typedef struct {
+    bool valid;
+    float rpm_min;
+    float rpm_max;
+    float scale;                // LUT positions per RPM, fixed point
+    uint16_t off_value;
+    uint16_t min_value;
+    uint16_t value[SPINDLE_PWM_LUT_SIZE + 1];
+} spindle_pwm_lut_t;
+
+static DRAM_ATTR spindle_pwm_lut_t spindle_pwm_lut = {0};
+
+#endif
+
 static ledc_timer_config_t spindle_pwm_timer = {
 #if CONFIG_IDF_TARGET_ESP32S3
     .speed_mode = LEDC_LOW_SPEED_MODE,
@@ -240,6 +277,9 @@ static input_signal_t inputpin[] = {
     { .id = Input_I2CStrobe,    .pin = I2C_STROBE_PIN,    .group = PinGroup_Keypad },
   #endif
 #endif // AUX_DEVICES
+#if SPINDLE_ENCODER_ENABLE && defined(SPINDLE_INDEX_PIN)
+    { .id = Input_SpindleIndex, .pin = SPINDLE_INDEX_PIN, .group = PinGroup_SpindleIndex },
+#endif
 // Aux input pins must be consecutive in this array
 #ifdef AUXINPUT0_PIN
     { .id = Input_Aux0,         .pin = AUXINPUT0_PIN,       .group = PinGroup_AuxInput },
@@ -275,6 +315,12 @@ static input_signal_t inputpin[] = {
 
 const size_t inputPinsCount = sizeof(inputpin) / sizeof(input_signal_t);
 
+#if !ETHERNET_ENABLE
+// Input signals indexed by GPIO number, covers both interrupt status words.
+// Inputs sharing a GPIO are chained via dispatch_next.
+static DRAM_ATTR input_signal_t *gpio_dispatch[64] = {0};
+#endif
+
 static output_signal_t outputpin[] = {
     { .id = Output_StepX,          .pin = X_STEP_PIN,            .group = PinGroup_StepperStep },
     { .id = Output_StepY,          .pin = Y_STEP_PIN,            .group = PinGroup_StepperStep },
@@ -443,12 +489,30 @@ static probe_state_t probe = {
 };
 #endif
 
+#if PROBE_ISR && AUX_CONTROLS_ENABLED && defined(PROBE_PIN)
+
+#define PROBE_TIMESTAMP 1
+
+typedef struct {
+    volatile bool edge_valid;
+    volatile uint32_t edge;         // esp_timer time (us) at the probe edge
+    uint32_t pulse;                 // esp_timer time (us) at the last step pulse output while probing
+    axes_signals_t step_outbits;    // and its step and direction bits
+    axes_signals_t dir_outbits;
+    void (*pulse_start)(stepper_t *stepper);
+} probe_timestamp_t;
+
+static DRAM_ATTR probe_timestamp_t probe_ts = {0};
+
+#endif
+
 #if IOEXPAND_ENABLE
 static ioexpand_t iopins = {0};
 #endif
 
 #ifdef NEOPIXELS_PIN
 neopixel_cfg_t neopixel = { .intensity = 255 };
+static bool neopixels_alloc (uint16_t num_leds);
 #endif
 
 #if AUX_CONTROLS_ENABLED
@@ -460,6 +524,37 @@ static input_signal_t *safety_door = NULL;
 static void aux_irq_handler (uint8_t port, bool state);
 #endif
 
+typedef struct {
+#if USE_I2S_OUT
+    uint8_t i2s_dma_profile;
+#endif
+    uint16_t limit_debounce;    // microseconds
+    uint16_t control_debounce;  // microseconds
+#if SPINDLE_ENCODER_ENABLE
+    uint16_t spindle_rpm_filter; // milliseconds
+#endif
+} driver_settings_t;
+
+static driver_settings_t driver_settings = {
+    .limit_debounce = DEBOUNCE_TIME_US,
+    .control_debounce = DEBOUNCE_TIME_US,
+#if SPINDLE_ENCODER_ENABLE
+    .spindle_rpm_filter = SPINDLE_RPM_FILTER_MS
+#endif
+};
+
+typedef struct {
+    input_signal_t *input;
+    esp_timer_handle_t timer;
+    uint32_t window;            // microseconds, 0 if not debounced
+    volatile uint32_t events;   // edges that started a debounce window
+    volatile uint32_t glitches; // windows that ended with the input back at its inactive level
+} input_debounce_t;
+
+static input_debounce_t input_debounce[sizeof(inputpin) / sizeof(input_signal_t)] = {0};
+
+void pin_debounce (void *pin);
+
 #if I2C_STROBE_ENABLE
 
 static driver_irq_handler_t i2c_strobe = { .type = IRQ_I2C_Strobe };
@@ -487,6 +582,9 @@ static void gpio_mpg_isr (void *signal);
 #if I2C_STROBE_ENABLE
 static void gpio_i2c_strobe_isr (void *signal);
 #endif
+#if SPINDLE_ENCODER_ENABLE && defined(SPINDLE_INDEX_PIN)
+static void gpio_spindle_index_isr (void *signal);
+#endif
 #else
 static void gpio_isr (void *arg);
 #endif
@@ -601,9 +699,92 @@ static void stepperWakeUp (void)
 #endif
 }
 
+#if STEP_TRACE_ENABLE
+
+/*** Step output trace ***/
+
+#define STEP_TRACE_SIZE 512 // must be a power of 2
+
+typedef struct {
+    uint32_t ticks;         // programmed timeline in step timer ticks
+    uint32_t ccount;        // CPU cycle counter at pulse start
+    uint16_t cycles;        // CPU cycles spent in pulse_start
+    uint8_t step;
+    uint8_t dir;
+} step_trace_event_t;
+
+typedef struct {
+    uint32_t head;
+    uint32_t events;
+    uint32_t ticks;
+    uint32_t cycles_per_tick;
+    uint32_t isr_min;
+    uint32_t isr_max;
+    uint64_t isr_total;
+    uint32_t isr_count;
+    uint32_t skew_max;      // CPU cycles from first to last RMT channel start
+    uint64_t skew_total;
+    uint32_t skew_count;
+    step_trace_event_t event[STEP_TRACE_SIZE];
+} step_trace_t;
+
+static DRAM_ATTR step_trace_t step_trace = { .isr_min = UINT32_MAX };
+
+inline __attribute__((always_inline)) IRAM_ATTR static uint32_t step_trace_begin (void)
+{
+    return XTHAL_GET_CCOUNT();
+}
+
+// Called on exit from pulse_start, logs step and direction changes against the programmed timeline.
+inline __attribute__((always_inline)) IRAM_ATTR static void step_trace_end (stepper_t *stepper, uint32_t ccount)
+{
+    uint32_t cycles = XTHAL_GET_CCOUNT() - ccount;
+
+    step_trace.ticks += step_trace.cycles_per_tick;
+
+    if(stepper->step_outbits.value || stepper->dir_change) {
+
+        step_trace_event_t *event = &step_trace.event[step_trace.head];
+
+        event->ticks = step_trace.ticks;
+        event->ccount = ccount;
+        event->cycles = cycles > UINT16_MAX ? UINT16_MAX : cycles;
+        event->step = stepper->step_outbits.value;
+        event->dir = stepper->dir_change ? (stepper->dir_outbits.value | 0x80) : stepper->dir_outbits.value;
+
+        step_trace.head = (step_trace.head + 1) & (STEP_TRACE_SIZE - 1);
+        step_trace.events++;
+
+        if(cycles < step_trace.isr_min)
+            step_trace.isr_min = cycles;
+        if(cycles > step_trace.isr_max)
+            step_trace.isr_max = cycles;
+        step_trace.isr_total += cycles;
+        step_trace.isr_count++;
+    }
+}
+
+inline __attribute__((always_inline)) IRAM_ATTR static void step_trace_skew (uint32_t cycles)
+{
+    if(cycles > step_trace.skew_max)
+        step_trace.skew_max = cycles;
+    step_trace.skew_total += cycles;
+    step_trace.skew_count++;
+}
+
+inline __attribute__((always_inline)) IRAM_ATTR static void step_trace_set_tick (uint32_t cycles_per_tick)
+{
+    step_trace.cycles_per_tick = cycles_per_tick;
+}
+
+#endif // STEP_TRACE_ENABLE
+
 // Sets up stepper driver interrupt timeout
 IRAM_ATTR static void stepperCyclesPerTick (uint32_t cycles_per_tick)
 {
+#if STEP_TRACE_ENABLE
+    step_trace_set_tick(cycles_per_tick);
+#endif
 // Limit min steps/s to about 2 (hal.f_step_timer @ 20MHz)
 #if CONFIG_IDF_TARGET_ESP32S3
   #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
@@ -620,49 +801,254 @@ IRAM_ATTR static void stepperCyclesPerTick (uint32_t cycles_per_tick)
 #endif
 }
 
-// Set stepper direction output pins
-// NOTE: see note for set_step_outputs()
-inline IRAM_ATTR static void set_dir_outputs (axes_signals_t dir_outbits)
+/*** Step and direction output tables ***/
+
+// Register masks for a step or direction output pattern, indexed by the axes_signals_t value.
+typedef struct {
+    uint32_t set[2];    // GPIO0-31 and GPIO32-39 W1TS
+    uint32_t clr[2];    // GPIO0-31 and GPIO32-39 W1TC
+#if USE_I2S_OUT
+    uint32_t i2s_set;
+    uint32_t i2s_clr;
+#endif
+} out_masks_t;
+
+#if USE_I2S_OUT
+typedef out_masks_t step_out_t;
+#else
+typedef uint32_t step_out_t; // RMT channels to start per step pattern
+#endif
+
+static DRAM_ATTR out_masks_t dir_out[1 << N_AXIS];
+
+#ifdef SQUARING_ENABLED
+// The step table is double buffered as it is rebuilt when motors are enabled/disabled for auto squaring,
+// the new table is built while the stepper interrupt uses the current one and then swapped in.
+static DRAM_ATTR step_out_t step_out_buf[2][1 << N_AXIS];
+static DRAM_ATTR step_out_t *volatile step_out = step_out_buf[0];
+static axes_signals_t motors_1 = {AXES_BITMASK}, motors_2 = {AXES_BITMASK};
+#else
+static DRAM_ATTR step_out_t step_out[1 << N_AXIS];
+#endif
+
+static void out_masks_add (out_masks_t *masks, uint8_t pin, bool on)
+{
+#if USE_I2S_OUT
+    if(pin >= I2S_OUT_PIN_BASE) {
+        if(on)
+            masks->i2s_set |= bit(pin - I2S_OUT_PIN_BASE);
+        else
+            masks->i2s_clr |= bit(pin - I2S_OUT_PIN_BASE);
+        return;
+    }
+#endif
+
+    if(on)
+        masks->set[pin >> 5] |= bit(pin & 0x1F);
+    else
+        masks->clr[pin >> 5] |= bit(pin & 0x1F);
+}
+
+// Builds the direction output table with inversion and ganging masks folded in.
+static void dir_out_init (settings_t *settings)
 {
-    dir_outbits.value ^= settings.steppers.dir_invert.mask;
+    uint32_t idx;
+    out_masks_t masks;
+    axes_signals_t signals;
+
+    for(idx = 0; idx < (1 << N_AXIS); idx++) {
+
+        memset(&masks, 0, sizeof(out_masks_t));
+        signals.mask = idx ^ settings->steppers.dir_invert.mask;
 
-    DIGITAL_OUT(X_DIRECTION_PIN, dir_outbits.x);
-    DIGITAL_OUT(Y_DIRECTION_PIN, dir_outbits.y);
+        out_masks_add(&masks, X_DIRECTION_PIN, signals.x);
+        out_masks_add(&masks, Y_DIRECTION_PIN, signals.y);
 #ifdef Z_DIRECTION_PIN
-    DIGITAL_OUT(Z_DIRECTION_PIN, dir_outbits.z);
+        out_masks_add(&masks, Z_DIRECTION_PIN, signals.z);
 #endif
 #ifdef A_AXIS
-    DIGITAL_OUT(A_DIRECTION_PIN, dir_outbits.a);
+        out_masks_add(&masks, A_DIRECTION_PIN, signals.a);
 #endif
 #ifdef B_AXIS
-    DIGITAL_OUT(B_DIRECTION_PIN, dir_outbits.b);
+        out_masks_add(&masks, B_DIRECTION_PIN, signals.b);
 #endif
 #ifdef C_AXIS
-    DIGITAL_OUT(C_DIRECTION_PIN, dir_outbits.c);
+        out_masks_add(&masks, C_DIRECTION_PIN, signals.c);
 #endif
 #ifdef GANGING_ENABLED
-    dir_outbits.mask ^= settings.steppers.ganged_dir_invert.mask;
+        signals.mask ^= settings->steppers.ganged_dir_invert.mask;
   #ifdef X2_DIRECTION_PIN
-    DIGITAL_OUT(X2_DIRECTION_PIN, dir_outbits.x);
+        out_masks_add(&masks, X2_DIRECTION_PIN, signals.x);
   #endif
   #ifdef Y2_DIRECTION_PIN
-    DIGITAL_OUT(Y2_DIRECTION_PIN, dir_outbits.y);
+        out_masks_add(&masks, Y2_DIRECTION_PIN, signals.y);
   #endif
   #ifdef Z2_DIRECTION_PIN
-    DIGITAL_OUT(Z2_DIRECTION_PIN, dir_outbits.z);
+        out_masks_add(&masks, Z2_DIRECTION_PIN, signals.z);
   #endif
 #endif
+        dir_out[idx] = masks;
+    }
+}
+
+// Builds a step output table with inversion, ganging and squaring masks folded in.
+static void step_out_init (settings_t *settings, step_out_t *table)
+{
+    uint32_t idx;
+
+    for(idx = 0; idx < (1 << N_AXIS); idx++) {
+
+#if USE_I2S_OUT
+
+        out_masks_t masks;
+        axes_signals_t signals;
+
+        memset(&masks, 0, sizeof(out_masks_t));
+
+  #ifdef SQUARING_ENABLED
+        axes_signals_t signals_2;
+        signals_2.mask = (idx & motors_2.mask) ^ settings->steppers.step_invert.mask;
+        signals.mask = (idx & motors_1.mask) ^ settings->steppers.step_invert.mask;
+  #else
+        signals.mask = idx ^ settings->steppers.step_invert.mask;
+  #endif
+
+        out_masks_add(&masks, X_STEP_PIN, signals.x);
+        out_masks_add(&masks, Y_STEP_PIN, signals.y);
+  #ifdef Z_STEP_PIN
+        out_masks_add(&masks, Z_STEP_PIN, signals.z);
+  #endif
+  #ifdef SQUARING_ENABLED
+   #ifdef X2_STEP_PIN
+        out_masks_add(&masks, X2_STEP_PIN, signals_2.x);
+   #endif
+   #ifdef Y2_STEP_PIN
+        out_masks_add(&masks, Y2_STEP_PIN, signals_2.y);
+   #endif
+   #ifdef Z2_STEP_PIN
+        out_masks_add(&masks, Z2_STEP_PIN, signals_2.z);
+   #endif
+  #else
+   #ifdef X2_STEP_PIN
+        out_masks_add(&masks, X2_STEP_PIN, signals.x);
+   #endif
+   #ifdef Y2_STEP_PIN
+        out_masks_add(&masks, Y2_STEP_PIN, signals.y);
+   #endif
+   #ifdef Z2_STEP_PIN
+        out_masks_add(&masks, Z2_STEP_PIN, signals.z);
+   #endif
+  #endif
+  #ifdef A_AXIS
+        out_masks_add(&masks, A_STEP_PIN, signals.a);
+  #endif
+  #ifdef B_AXIS
+        out_masks_add(&masks, B_STEP_PIN, signals.b);
+  #endif
+  #ifdef C_AXIS
+        out_masks_add(&masks, C_STEP_PIN, signals.c);
+  #endif
+        table[idx] = masks;
+
+#else // RMT stepping
+
+        uint32_t channels = idx;
+
+  #ifdef SQUARING_ENABLED
+        channels &= motors_1.mask;
+   #ifdef X2_STEP_PIN
+        if(idx & motors_2.mask & X_AXIS_BIT)
+            channels |= bit(X2_MOTOR);
+   #endif
+   #ifdef Y2_STEP_PIN
+        if(idx & motors_2.mask & Y_AXIS_BIT)
+            channels |= bit(Y2_MOTOR);
+   #endif
+   #ifdef Z2_STEP_PIN
+        if(idx & motors_2.mask & Z_AXIS_BIT)
+            channels |= bit(Z2_MOTOR);
+   #endif
+  #else
+   #ifdef X2_STEP_PIN
+        if(idx & X_AXIS_BIT)
+            channels |= bit(X2_MOTOR);
+   #endif
+   #ifdef Y2_STEP_PIN
+        if(idx & Y_AXIS_BIT)
+            channels |= bit(Y2_MOTOR);
+   #endif
+   #ifdef Z2_STEP_PIN
+        if(idx & Z_AXIS_BIT)
+            channels |= bit(Z2_MOTOR);
+   #endif
+  #endif
+  #ifndef Z_STEP_PIN
+        channels &= ~bit(Z_AXIS);
+  #endif
+        table[idx] = channels;
+
+#endif // USE_I2S_OUT
+    }
 }
 
 #ifdef SQUARING_ENABLED
 
-static axes_signals_t motors_1 = {AXES_BITMASK}, motors_2 = {AXES_BITMASK};
+// Builds the step output table not in use and swaps it in.
+static void step_out_swap (settings_t *settings)
+{
+    step_out_t *table = step_out == step_out_buf[0] ? step_out_buf[1] : step_out_buf[0];
+
+    step_out_init(settings, table);
+    __sync_synchronize(); // the table must be complete before the stepper interrupt can see it
+    step_out = table;
+}
+
+#endif
+
+// Builds the output tables, called on settings changes.
+static void out_masks_init (settings_t *settings)
+{
+    dir_out_init(settings);
+#ifdef SQUARING_ENABLED
+    step_out_swap(settings);
+#else
+    step_out_init(settings, step_out);
+#endif
+}
+
+// Outputs a precomputed pattern, at most four GPIO register writes plus one I2S port update.
+inline __attribute__((always_inline)) IRAM_ATTR static void out_masks_write (const out_masks_t *masks)
+{
+    if(masks->set[0] | masks->clr[0]) {
+        GPIO.out_w1ts = masks->set[0];
+        GPIO.out_w1tc = masks->clr[0];
+    }
+    if(masks->set[1] | masks->clr[1]) {
+        GPIO.out1_w1ts.val = masks->set[1];
+        GPIO.out1_w1tc.val = masks->clr[1];
+    }
+#if USE_I2S_OUT
+    if(masks->i2s_set | masks->i2s_clr)
+        i2s_out_write_masked(masks->i2s_set, masks->i2s_clr);
+#endif
+}
+
+// Set stepper direction output pins
+// NOTE: see note for set_step_outputs()
+inline IRAM_ATTR static void set_dir_outputs (axes_signals_t dir_outbits)
+{
+    out_masks_write(&dir_out[dir_outbits.mask & AXES_BITMASK]);
+}
+
+#ifdef SQUARING_ENABLED
 
 // Enable/disable motors for auto squaring of ganged axes
 static void StepperDisableMotors (axes_signals_t axes, squaring_mode_t mode)
 {
     motors_1.mask = (mode == SquaringMode_A || mode == SquaringMode_Both ? axes.mask : 0) ^ AXES_BITMASK;
     motors_2.mask = (mode == SquaringMode_B || mode == SquaringMode_Both ? axes.mask : 0) ^ AXES_BITMASK;
+
+    step_out_swap(&settings);
 }
 
 #endif // SQUARING_ENABLED
@@ -670,6 +1056,8 @@ static void StepperDisableMotors (axes_signals_t axes, squaring_mode_t mode)
 #if USE_I2S_OUT
 
 static bool goIdlePending = false;
+static out_masks_t *i2s_step = NULL;
+static uint32_t i2s_step_delay = 0;
 static uint32_t i2s_step_length = I2S_OUT_USEC_PER_PULSE, i2s_delay_length = I2S_OUT_USEC_PER_PULSE, i2s_delay_samples = 1, i2s_step_samples = 1;
 static bool laser_mode = false;
 #if DRIVER_SPINDLE_ENABLE
@@ -677,31 +1065,13 @@ static on_spindle_selected_ptr on_spindle_selected;
 #endif
 
 // Set stepper pulse output pins
-inline __attribute__((always_inline)) IRAM_ATTR static void i2s_set_step_outputs (axes_signals_t step_outbits_1);
-
-#if !CONFIG_IDF_TARGET_ESP32S3
-
-IRAM_ATTR static void delay_us (uint32_t us)
-{
-#if CONFIG_IDF_TARGET_ESP32S3
-    int32_t t = XTHAL_GET_CCOUNT() + hal.f_mcu * us;
-
-    while((XTHAL_GET_CCOUNT() - t) < 0) {
-        __asm__ __volatile__ ("nop");
-    }
-#else
-    uint64_t start_time = esp_timer_get_time();
-
-    while (esp_timer_get_time() - start_time < us) {
-        __asm__ __volatile__ ("nop");
-    }
-#endif
-}
-
-#endif // !CONFIG_IDF_TARGET_ESP32S3
+inline __attribute__((always_inline)) IRAM_ATTR static void i2s_set_step_outputs (axes_signals_t step_outbits);
 
 IRAM_ATTR static void I2SStepperCyclesPerTick (uint32_t cycles_per_tick)
 {
+#if STEP_TRACE_ENABLE
+    step_trace_set_tick(cycles_per_tick);
+#endif
     i2s_out_set_pulse_period((cycles_per_tick < (1UL << 18) ? cycles_per_tick : (1UL << 18) - 1UL) / (hal.f_step_timer / 1000000));
 }
 
@@ -709,17 +1079,37 @@ IRAM_ATTR static void I2SStepperCyclesPerTick (uint32_t cycles_per_tick)
 // Called when in I2S stepping mode
 IRAM_ATTR static void I2SStepperPulseStart (stepper_t *stepper)
 {
-    if(stepper->dir_change) {
+#if STEP_TRACE_ENABLE
+    uint32_t ccount = step_trace_begin();
+#endif
+
+    if(stepper->dir_change)
         set_dir_outputs(stepper->dir_outbits);
-        if(stepper->step_outbits.value)
-            i2s_out_push_sample(i2s_delay_samples);
-    }
 
+    // The step is queued by I2SStepperFill() when the step period is known.
     if(stepper->step_outbits.value) {
-        i2s_set_step_outputs(stepper->step_outbits);
-        i2s_out_push_sample(i2s_step_samples);
-        i2s_set_step_outputs((axes_signals_t){0});
+        i2s_step = &step_out[stepper->step_outbits.mask & AXES_BITMASK];
+        i2s_step_delay = stepper->dir_change ? i2s_delay_samples : 0;
     }
+
+#if STEP_TRACE_ENABLE
+    step_trace_end(stepper, ccount);
+#endif
+}
+
+// I2S pulse callback, runs the stepper interrupt handler for as many step periods
+// as fits in the DMA buffer being filled. Each period is queued as a step segment record,
+// after the handler has returned as it may change the period for the next step.
+IRAM_ATTR static void I2SStepperFill (void)
+{
+    do {
+        i2s_step = NULL;
+        hal.stepper.interrupt_callback();
+        if(i2s_step)
+            i2s_out_push_segment(i2s_step->i2s_set, i2s_step->i2s_clr, i2s_step_delay, i2s_step_samples);
+        else
+            i2s_out_push_segment(0, 0, 0, 0);
+    } while(i2s_out_segment_room());
 }
 
 // Starts stepper driver ISR timer and forces a stepper driver interrupt callback
@@ -727,76 +1117,17 @@ static void I2SStepperWakeUp (void)
 {
     // Enable stepper drivers.
     stepperEnable((axes_signals_t){AXES_BITMASK});
+    // Step pulses are pushed as records on top of the idle step levels.
+    i2s_set_step_outputs((axes_signals_t){0});
     i2s_out_set_stepping();
 }
 
-#ifdef SQUARING_ENABLED
-
-// Set stepper pulse output pins
-inline __attribute__((always_inline)) IRAM_ATTR static void i2s_set_step_outputs (axes_signals_t step_outbits_1)
-{
-    axes_signals_t step_outbits_2;
-    step_outbits_2.mask = (step_outbits_1.mask & motors_2.mask) ^ settings.steppers.step_invert.mask;
-    step_outbits_1.mask = (step_outbits_1.mask & motors_1.mask) ^ settings.steppers.step_invert.mask;
-
-    DIGITAL_OUT(X_STEP_PIN, step_outbits_1.x);
-    DIGITAL_OUT(Y_STEP_PIN, step_outbits_1.y);
-#ifdef Z_STEP_PIN
-    DIGITAL_OUT(Z_STEP_PIN, step_outbits_1.z);
-#endif
-#ifdef X2_STEP_PIN
-    DIGITAL_OUT(X2_STEP_PIN, step_outbits_2.x);
-#endif
-#ifdef Y2_STEP_PIN
-    DIGITAL_OUT(Y2_STEP_PIN, step_outbits_2.y);
-#endif
-#ifdef Z2_STEP_PIN
-    DIGITAL_OUT(Z2_STEP_PIN, step_outbits_2.z);
-#endif
-#ifdef A_AXIS
-    DIGITAL_OUT(A_STEP_PIN, step_outbits_1.a);
-#endif
-#ifdef B_AXIS
-    DIGITAL_OUT(B_STEP_PIN, step_outbits_1.b);
-#endif
-#ifdef C_AXIS
-    DIGITAL_OUT(C_STEP_PIN, step_outbits_1.c);
-#endif
-}
-
-#else // !SQUARING_ENABLED
-
 // Set stepper pulse output pins
 inline __attribute__((always_inline)) IRAM_ATTR static void i2s_set_step_outputs (axes_signals_t step_outbits)
 {
-    step_outbits.value ^= settings.steppers.step_invert.mask;
-    DIGITAL_OUT(X_STEP_PIN, step_outbits.x);
-    DIGITAL_OUT(Y_STEP_PIN, step_outbits.y);
-#ifdef Z_STEP_PIN
-    DIGITAL_OUT(Z_STEP_PIN, step_outbits.z);
-#endif
-#ifdef X2_STEP_PIN
-    DIGITAL_OUT(X2_STEP_PIN, step_outbits.x);
-#endif
-#ifdef Y2_STEP_PIN
-    DIGITAL_OUT(Y2_STEP_PIN, step_outbits.y);
-#endif
-#ifdef Z2_STEP_PIN
-    DIGITAL_OUT(Z2_STEP_PIN, step_outbits.z);
-#endif
-#ifdef A_AXIS
-    DIGITAL_OUT(A_STEP_PIN, step_outbits.a);
-#endif
-#ifdef B_AXIS
-    DIGITAL_OUT(B_STEP_PIN, step_outbits.b);
-#endif
-#ifdef C_AXIS
-    DIGITAL_OUT(C_STEP_PIN, step_outbits.c);
-#endif
+    out_masks_write(&step_out[step_outbits.mask & AXES_BITMASK]);
 }
 
-#endif // !SQUARING_ENABLED
-
 #if STEP_INJECT_ENABLE
 
 void stepperOutputStep (axes_signals_t step_outbits, axes_signals_t dir_outbits)
@@ -916,6 +1247,18 @@ IRAM_ATTR static void I2SStepperGoIdle (bool clear_signals)
 
 #else // RMT stepping
 
+#ifndef RMT_SYNC_START
+#ifdef SOC_RMT_SUPPORT_TX_SYNCHRO
+#define RMT_SYNC_START 1
+#else
+#define RMT_SYNC_START 0
+#endif
+#endif
+
+#if RMT_SYNC_START
+#include "soc/rmt_reg.h"
+#endif
+
 void initRMT (settings_t *settings)
 {
     rmt_item32_t rmtItem[2];
@@ -1007,128 +1350,32 @@ void initRMT (settings_t *settings)
     }
 }
 
-#ifdef SQUARING_ENABLED
-
 // Set stepper pulse output pins
-inline IRAM_ATTR static void set_step_outputs (axes_signals_t step_outbits_1)
+// Starts the RMT channels looked up from the step pattern, in sync mode all channels start
+// simultaneously when the last one is armed.
+inline IRAM_ATTR static void set_step_outputs (axes_signals_t step_outbits)
 {
-    axes_signals_t step_outbits_2;
-    step_outbits_2.mask = (step_outbits_1.mask & motors_2.mask) ^ settings.steppers.step_invert.mask;
-    step_outbits_1.mask = (step_outbits_1.mask & motors_1.mask) ^ settings.steppers.step_invert.mask;
+    uint32_t ch, channels = step_out[step_outbits.mask & AXES_BITMASK];
 
-    if(step_outbits_1.x) {
-        rmt_ll_tx_reset_pointer(&RMT, X_AXIS);
-        rmt_ll_tx_start(&RMT, X_AXIS);
-    }
-#ifdef X2_STEP_PIN
-    if(step_outbits_2.x) {
-        rmt_ll_tx_reset_pointer(&RMT, X2_MOTOR);
-        rmt_ll_tx_start(&RMT, X2_MOTOR);
-    }
+    if(channels) {
+#if RMT_SYNC_START
+        RMT.tx_sim.val = channels | RMT_TX_SIM_EN;
 #endif
-
-    if(step_outbits_1.y) {
-        rmt_ll_tx_reset_pointer(&RMT, Y_AXIS);
-        rmt_ll_tx_start(&RMT, Y_AXIS);
-    }
-#ifdef Y2_STEP_PIN
-    if(step_outbits_2.y) {
-        rmt_ll_tx_reset_pointer(&RMT, Y2_MOTOR);
-        rmt_ll_tx_start(&RMT, Y2_MOTOR);
-    }
+#if STEP_TRACE_ENABLE
+        uint32_t ccount = XTHAL_GET_CCOUNT();
+#endif
+        do {
+            ch = __builtin_ctz(channels);
+            channels &= (channels - 1);
+            rmt_ll_tx_reset_pointer(&RMT, ch);
+            rmt_ll_tx_start(&RMT, ch);
+        } while(channels);
+#if STEP_TRACE_ENABLE
+        step_trace_skew(XTHAL_GET_CCOUNT() - ccount);
 #endif
-
-#ifdef Z_STEP_PIN
-    if(step_outbits_1.z) {
-        rmt_ll_tx_reset_pointer(&RMT, Z_AXIS);
-        rmt_ll_tx_start(&RMT, Z_AXIS);
-    }
-  #ifdef Z2_STEP_PIN
-    if(step_outbits_2.z) {
-        rmt_ll_tx_reset_pointer(&RMT, Z2_MOTOR);
-        rmt_ll_tx_start(&RMT, Z2_MOTOR);
     }
-  #endif
-#endif // Z_STEP_PIN
-
-#ifdef A_STEP_PIN
-    if(step_outbits_1.a) {
-        rmt_ll_tx_reset_pointer(&RMT, A_AXIS);
-        rmt_ll_tx_start(&RMT, A_AXIS);
-    }
-#endif
-
-#ifdef B_STEP_PIN
-    if(step_outbits_1.b) {
-        rmt_ll_tx_reset_pointer(&RMT, B_AXIS);
-        rmt_ll_tx_start(&RMT, B_AXIS);
-    }
-#endif
-
-#ifdef C_STEP_PIN
-    if(step_outbits_1.c) {
-        rmt_ll_tx_reset_pointer(&RMT, C_AXIS);
-        rmt_ll_tx_start(&RMT, C_AXIS);
-    }
-#endif
 }
 
-#else // !SQUARING_ENABLED
-
-// Set stepper pulse output pins
-inline IRAM_ATTR static void set_step_outputs (axes_signals_t step_outbits)
-{
-    if(step_outbits.x) {
-        rmt_ll_tx_reset_pointer(&RMT, X_AXIS);
-        rmt_ll_tx_start(&RMT, X_AXIS);
-#ifdef X2_STEP_PIN
-        rmt_ll_tx_reset_pointer(&RMT, X2_MOTOR);
-        rmt_ll_tx_start(&RMT, X2_MOTOR);
-#endif
-    }
-
-    if(step_outbits.y) {
-        rmt_ll_tx_reset_pointer(&RMT, Y_AXIS);
-        rmt_ll_tx_start(&RMT, Y_AXIS);
-#ifdef Y2_STEP_PIN
-        rmt_ll_tx_reset_pointer(&RMT, Y2_MOTOR);
-        rmt_ll_tx_start(&RMT, Y2_MOTOR);
-#endif
-    }
-
-#ifdef Z_STEP_PIN
-    if(step_outbits.z) {
-        rmt_ll_tx_reset_pointer(&RMT, Z_AXIS);
-        rmt_ll_tx_start(&RMT, Z_AXIS);
-  #ifdef Z2_STEP_PIN
-        rmt_ll_tx_reset_pointer(&RMT, Z2_MOTOR);
-        rmt_ll_tx_start(&RMT, Z2_MOTOR);
-  #endif
-    }
-#endif
-
-#ifdef A_STEP_PIN
-    if(step_outbits.a) {
-        rmt_ll_tx_reset_pointer(&RMT, A_AXIS);
-        rmt_ll_tx_start(&RMT, A_AXIS);
-    }
-#endif
-#ifdef B_STEP_PIN
-    if(step_outbits.b) {
-        rmt_ll_tx_reset_pointer(&RMT, B_AXIS);
-        rmt_ll_tx_start(&RMT, B_AXIS);
-    }
-#endif
-#ifdef C_STEP_PIN
-    if(step_outbits.c) {
-        rmt_ll_tx_reset_pointer(&RMT, C_AXIS);
-        rmt_ll_tx_start(&RMT, C_AXIS);
-    }
-#endif
-}
-
-#endif // !SQUARING_ENABLED
-
 #if STEP_INJECT_ENABLE
 
 void stepperOutputStep (axes_signals_t step_outbits, axes_signals_t dir_outbits)
@@ -1175,55 +1422,7 @@ void stepperOutputStep (axes_signals_t step_outbits, axes_signals_t dir_outbits)
             DIGITAL_OUT(C_DIRECTION_PIN, dir_outbits.c);
 #endif
 
-        if(step_outbits.x) {
-            rmt_ll_tx_reset_pointer(&RMT, X_AXIS);
-            rmt_ll_tx_start(&RMT, X_AXIS);
-#ifdef X2_STEP_PIN
-            rmt_ll_tx_reset_pointer(&RMT, X2_MOTOR);
-            rmt_ll_tx_start(&RMT, X2_MOTOR);
-#endif
-        }
-
-        if(step_outbits.y) {
-            rmt_ll_tx_reset_pointer(&RMT, Y_AXIS);
-            rmt_ll_tx_start(&RMT, Y_AXIS);
-#ifdef Y2_STEP_PIN
-            rmt_ll_tx_reset_pointer(&RMT, Y2_MOTOR);
-            rmt_ll_tx_start(&RMT, Y2_MOTOR);
-#endif
-        }
-
-#ifdef Z_STEP_PIN
-        if(step_outbits.z) {
-            rmt_ll_tx_reset_pointer(&RMT, Z_AXIS);
-            rmt_ll_tx_start(&RMT, Z_AXIS);
-  #ifdef Z2_STEP_PIN
-            rmt_ll_tx_reset_pointer(&RMT, Z2_MOTOR);
-            rmt_ll_tx_start(&RMT, Z2_MOTOR);
-  #endif
-        }
-#endif
-
-#ifdef A_AXIS
-        if(step_outbits.a) {
-            rmt_ll_tx_reset_pointer(&RMT, A_AXIS);
-            rmt_ll_tx_start(&RMT, A_AXIS);
-        }
-#endif
-
-#ifdef B_AXIS
-        if(step_outbits.b) {
-            rmt_ll_tx_reset_pointer(&RMT, B_AXIS);
-            rmt_ll_tx_start(&RMT, B_AXIS);
-        }
-#endif
-
-#ifdef C_AXIS
-        if(step_outbits.c) {
-            rmt_ll_tx_reset_pointer(&RMT, C_AXIS);
-            rmt_ll_tx_start(&RMT, C_AXIS);
-        }
-#endif
+        set_step_outputs(step_outbits);
     }
 }
 
@@ -1278,6 +1477,9 @@ IRAM_ATTR static void stepperPulseStart (stepper_t *stepper)
 #if USE_I2S_OUT
     static bool add_dir_delay = false;
 #endif
+#if STEP_TRACE_ENABLE
+    uint32_t ccount = step_trace_begin();
+#endif
 
     if(stepper->dir_change) {
         set_dir_outputs(stepper->dir_outbits);
@@ -1296,29 +1498,138 @@ IRAM_ATTR static void stepperPulseStart (stepper_t *stepper)
         set_step_outputs(stepper->step_outbits);
 #endif
     }
+
+#if STEP_TRACE_ENABLE
+    step_trace_end(stepper, ccount);
+#endif
 }
 
 #else
 
-IRAM_ATTR static void stepperPulseStart (stepper_t *stepper)
-{
-    if(stepper->dir_change) {
-        set_dir_outputs(stepper->dir_outbits);
 #if USE_I2S_OUT
-        if(stepper->step_outbits.value)
-            delay_us(i2s_delay_length + 1);
+
+// Passthrough mode step pulse timing, the direction setup time and the pulse are
+// timed by a one-shot alarm of the second timer in the stepper timer group.
+
+#ifndef PULSE_TIMER_INDEX
+#define PULSE_TIMER_INDEX TIMER_1
 #endif
+
+// The alarm and the stepper interrupts are level 1 interrupts on the same core so they do not preempt each other.
+
+typedef enum {
+    I2SPulse_Idle = 0,
+    I2SPulse_Delay,     // direction setup time elapsing
+    I2SPulse_Active
+} i2s_pulse_state_t;
+
+// Ticks arriving before the current pulse is completed are queued with their direction change and
+// output in order, each after a step low time or the direction setup time if longer. The step rate
+// is capped so that the queue does not grow.
+
+#define I2S_PULSE_QUEUE_SIZE 4 // must be a power of 2
+
+typedef struct {
+    axes_signals_t step_outbits;
+    axes_signals_t dir_outbits;
+    bool dir_change;
+} i2s_pulse_step_t;
+
+typedef struct {
+    volatile i2s_pulse_state_t state;
+    axes_signals_t step_outbits;    // step bits pending while the direction setup or step low time elapses
+    uint_fast8_t head;
+    uint_fast8_t tail;
+    i2s_pulse_step_t queue[I2S_PULSE_QUEUE_SIZE];
+    uint32_t delay_ticks;           // direction setup time
+    uint32_t pulse_ticks;           // step pulse length, also used as the minimum step low time
+    uint32_t min_period;            // min. step period, timer ticks
+} i2s_pulse_t;
+
+static DRAM_ATTR i2s_pulse_t i2s_pulse = {0};
+
+inline __attribute__((always_inline)) IRAM_ATTR static void i2s_pulse_timer_start (uint32_t ticks)
+{
+    timer_group_set_alarm_value_in_isr(STEP_TIMER_GROUP, PULSE_TIMER_INDEX, timer_group_get_counter_value_in_isr(STEP_TIMER_GROUP, PULSE_TIMER_INDEX) + ticks);
+    timer_group_enable_alarm_in_isr(STEP_TIMER_GROUP, PULSE_TIMER_INDEX);
+}
+
+// Starts a step pulse, after delay_ticks if not 0.
+inline __attribute__((always_inline)) IRAM_ATTR static void i2s_pulse_start (axes_signals_t step_outbits, uint32_t delay_ticks)
+{
+    if(delay_ticks) {
+        i2s_pulse.step_outbits = step_outbits;
+        i2s_pulse.state = I2SPulse_Delay;
+        i2s_pulse_timer_start(delay_ticks);
+    } else {
+        i2s_set_step_outputs(step_outbits);
+        i2s_pulse.state = I2SPulse_Active;
+        i2s_pulse_timer_start(i2s_pulse.pulse_ticks);
     }
+}
 
-    if(stepper->step_outbits.value) {
-#if USE_I2S_OUT
-        i2s_set_step_outputs(stepper->step_outbits);
-        delay_us(i2s_step_length + 1);
+IRAM_ATTR static void i2s_pulse_timer_isr (void *arg)
+{
+    timer_group_clr_intr_status_in_isr(STEP_TIMER_GROUP, PULSE_TIMER_INDEX);
+
+    if(i2s_pulse.state == I2SPulse_Delay)
+        i2s_pulse_start(i2s_pulse.step_outbits, 0);
+    else {
         i2s_set_step_outputs((axes_signals_t){0});
+        if(i2s_pulse.tail == i2s_pulse.head)
+            i2s_pulse.state = I2SPulse_Idle;
+        else {
+            i2s_pulse_step_t *step = &i2s_pulse.queue[i2s_pulse.tail];
+            i2s_pulse.tail = (i2s_pulse.tail + 1) & (I2S_PULSE_QUEUE_SIZE - 1);
+            if(step->dir_change)
+                set_dir_outputs(step->dir_outbits);
+            i2s_pulse_start(step->step_outbits, step->dir_change ? max(i2s_pulse.delay_ticks, i2s_pulse.pulse_ticks) : i2s_pulse.pulse_ticks);
+        }
+    }
+}
+
+// Caps the step rate so that a tick does not arrive before the previous step is completed.
+IRAM_ATTR static void i2sPulseCyclesPerTick (uint32_t cycles_per_tick)
+{
+    stepperCyclesPerTick(max(cycles_per_tick, i2s_pulse.min_period));
+}
+
+#endif // USE_I2S_OUT
+
+IRAM_ATTR static void stepperPulseStart (stepper_t *stepper)
+{
+#if STEP_TRACE_ENABLE
+    uint32_t ccount = step_trace_begin();
+#endif
+
+#if USE_I2S_OUT
+    if(i2s_pulse.state != I2SPulse_Idle) {
+        // Previous pulse not completed, queue the step and direction change to be output when it is.
+        // The step is lost if the queue is full, this should not happen due to the step rate cap.
+        uint_fast8_t next = (i2s_pulse.head + 1) & (I2S_PULSE_QUEUE_SIZE - 1);
+        if((stepper->step_outbits.value || stepper->dir_change) && next != i2s_pulse.tail) {
+            i2s_pulse.queue[i2s_pulse.head].step_outbits = stepper->step_outbits;
+            i2s_pulse.queue[i2s_pulse.head].dir_outbits = stepper->dir_outbits;
+            i2s_pulse.queue[i2s_pulse.head].dir_change = stepper->dir_change;
+            i2s_pulse.head = next;
+        }
+    } else {
+        if(stepper->dir_change)
+            set_dir_outputs(stepper->dir_outbits);
+        if(stepper->step_outbits.value)
+            i2s_pulse_start(stepper->step_outbits, stepper->dir_change ? i2s_pulse.delay_ticks : 0);
+    }
 #else
+    if(stepper->dir_change)
+        set_dir_outputs(stepper->dir_outbits);
+
+    if(stepper->step_outbits.value)
         set_step_outputs(stepper->step_outbits);
 #endif
-    }
+
+#if STEP_TRACE_ENABLE
+    step_trace_end(stepper, ccount);
+#endif
 }
 
 #endif
@@ -1333,6 +1644,10 @@ IRAM_ATTR static void stepperGoIdle (bool clear_signals)
 #endif
     if(clear_signals) {
 #if USE_I2S_OUT
+  #if !CONFIG_IDF_TARGET_ESP32S3
+        i2s_pulse.step_outbits.value = 0; // Cancel pending steps
+        i2s_pulse.tail = i2s_pulse.head;
+  #endif
         i2s_set_step_outputs((axes_signals_t){0});
 #else
         set_step_outputs((axes_signals_t){0});
@@ -1362,12 +1677,16 @@ static void i2s_set_streaming_mode (bool stream)
             hal.stepper.go_idle = I2SStepperGoIdle;
             hal.stepper.cycles_per_tick = I2SStepperCyclesPerTick;
             hal.stepper.pulse_start = I2SStepperPulseStart;
-            i2s_out_set_pulse_callback(hal.stepper.interrupt_callback);
+            i2s_out_set_pulse_callback(I2SStepperFill);
         }
     } else if(hal.stepper.wake_up != stepperWakeUp) {
         hal.stepper.wake_up = stepperWakeUp;
         hal.stepper.go_idle = stepperGoIdle;
+#if CONFIG_IDF_TARGET_ESP32S3
         hal.stepper.cycles_per_tick = stepperCyclesPerTick;
+#else
+        hal.stepper.cycles_per_tick = i2sPulseCyclesPerTick;
+#endif
         hal.stepper.pulse_start = stepperPulseStart;
         i2s_out_set_pulse_callback(i2s_step_sink);
     }
@@ -1387,6 +1706,227 @@ static void onSpindleSelected (spindle_ptrs_t *spindle)
 
 #endif // USE_I2S_OUT
 
+#if STEP_TRACE_ENABLE
+
+static void step_trace_reset (void)
+{
+    hal.irq_disable();
+    memset(&step_trace, 0, offsetof(step_trace_t, event));
+    step_trace.isr_min = UINT32_MAX;
+    hal.irq_enable();
+}
+
+static void step_trace_report (void)
+{
+    uint_fast8_t idx;
+    uint32_t i, n, last[N_AXIS] = {0}, min_delta[N_AXIS];
+    step_trace_event_t *event;
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        min_delta[idx] = UINT32_MAX;
+
+    // Find the shortest interval between consecutive steps per axis in the logged window.
+    n = step_trace.events < STEP_TRACE_SIZE ? step_trace.events : STEP_TRACE_SIZE;
+    i = (step_trace.head - n) & (STEP_TRACE_SIZE - 1);
+
+    while(n--) {
+        event = &step_trace.event[i];
+        for(idx = 0; idx < N_AXIS; idx++) {
+            if(event->step & bit(idx)) {
+                if(last[idx] && event->ticks - last[idx] < min_delta[idx])
+                    min_delta[idx] = event->ticks - last[idx];
+                last[idx] = event->ticks;
+            }
+        }
+        i = (i + 1) & (STEP_TRACE_SIZE - 1);
+    }
+
+    hal.stream.write("[STEPTRACE:");
+    hal.stream.write(uitoa(step_trace.events));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(step_trace.ticks));
+    hal.stream.write("]" ASCII_EOL);
+
+    hal.stream.write("[STEPRATE:");
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(idx)
+            hal.stream.write(",");
+        hal.stream.write(uitoa(min_delta[idx] == UINT32_MAX ? 0 : hal.f_step_timer / min_delta[idx]));
+    }
+    hal.stream.write("]" ASCII_EOL);
+
+    // Pulse width and direction setup time as quantized by the output hardware, in microseconds.
+    float pulse, delay;
+#if USE_I2S_OUT
+    if(hal.stepper.pulse_start == I2SStepperPulseStart) {
+        pulse = (float)(i2s_step_samples * I2S_OUT_USEC_PER_PULSE);
+        delay = (float)(i2s_delay_samples * I2S_OUT_USEC_PER_PULSE);
+    } else {
+  #if CONFIG_IDF_TARGET_ESP32S3
+        pulse = (float)(i2s_step_samples * I2S_OUT_USEC_PER_PULSE);
+        delay = (float)(i2s_delay_samples * I2S_OUT_USEC_PER_PULSE);
+  #else
+        pulse = (float)(i2s_step_length + 1);
+        delay = (float)(i2s_delay_length + 1);
+  #endif
+    }
+#else
+    pulse = (float)(uint32_t)(4.0f * settings.steppers.pulse_microseconds) / 4.0f;
+    delay = settings.steppers.pulse_delay_microseconds > 0.0f ? (float)(uint32_t)(4.0f * settings.steppers.pulse_delay_microseconds) / 4.0f : 0.25f;
+#endif
+
+    hal.stream.write("[STEPPULSE:");
+    hal.stream.write(ftoa(pulse, 2));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(delay, 2));
+    hal.stream.write("]" ASCII_EOL);
+
+    hal.stream.write("[STEPISR:");
+    hal.stream.write(uitoa(step_trace.isr_count ? step_trace.isr_min : 0));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(step_trace.isr_count ? (uint32_t)(step_trace.isr_total / step_trace.isr_count) : 0));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(step_trace.isr_max));
+    hal.stream.write("]" ASCII_EOL);
+
+#if !USE_I2S_OUT
+    // Arming span of the RMT channels, with sync start enabled the outputs are not skewed by it.
+    hal.stream.write("[STEPSKEW:");
+    hal.stream.write(uitoa(step_trace.skew_count ? (uint32_t)(step_trace.skew_total / step_trace.skew_count) : 0));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(step_trace.skew_max));
+    hal.stream.write(RMT_SYNC_START ? ",SYNC]" ASCII_EOL : "]" ASCII_EOL);
+#endif
+}
+
+static void step_trace_dump (void)
+{
+    uint32_t i, n;
+    step_trace_event_t *event;
+
+    n = step_trace.events < STEP_TRACE_SIZE ? step_trace.events : STEP_TRACE_SIZE;
+    i = (step_trace.head - n) & (STEP_TRACE_SIZE - 1);
+
+    while(n--) {
+        event = &step_trace.event[i];
+        hal.stream.write("[STEP:");
+        hal.stream.write(uitoa(event->ticks));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(event->ccount));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(event->step));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(event->dir & 0x7F));
+        hal.stream.write(event->dir & 0x80 ? ",1," : ",0,");
+        hal.stream.write(uitoa(event->cycles));
+        hal.stream.write("]" ASCII_EOL);
+        i = (i + 1) & (STEP_TRACE_SIZE - 1);
+    }
+}
+
+// $STEPTRACE reports a summary, $STEPTRACE=D dumps the logged events and $STEPTRACE=R clears the log.
+static status_code_t step_trace_command (sys_state_t state, char *args)
+{
+    status_code_t status = Status_OK;
+
+    if(args == NULL)
+        step_trace_report();
+    else if(*args == 'D' || *args == 'd')
+        step_trace_dump();
+    else if(*args == 'R' || *args == 'r')
+        step_trace_reset();
+    else
+        status = Status_InvalidStatement;
+
+    return status;
+}
+
+#endif // STEP_TRACE_ENABLE
+
+#if STEP_ISR_STATS_ENABLE
+
+/*** Step timer interrupt latency and execution time histograms ***/
+
+#define STEP_ISR_BUCKETS 12 // power of two microsecond buckets: <1, <2, <4 ... <1024, >= 1024
+
+typedef struct {
+    uint32_t ticks_per_us;
+    uint32_t count;
+    uint32_t latency_max;   // step timer ticks from alarm to interrupt entry
+    uint32_t exec_max;      // CPU cycles spent in the interrupt
+    uint32_t latency[STEP_ISR_BUCKETS];
+    uint32_t exec[STEP_ISR_BUCKETS];
+} step_isr_stats_t;
+
+static DRAM_ATTR step_isr_stats_t step_isr_stats = {0};
+
+inline __attribute__((always_inline)) IRAM_ATTR static uint32_t step_isr_bucket (uint32_t us)
+{
+    us = us ? 32 - __builtin_clz(us) : 0;
+
+    return us < STEP_ISR_BUCKETS ? us : STEP_ISR_BUCKETS - 1;
+}
+
+inline __attribute__((always_inline)) IRAM_ATTR static void step_isr_stats_add (uint32_t latency, uint32_t cycles)
+{
+    step_isr_stats.count++;
+
+    if(latency > step_isr_stats.latency_max)
+        step_isr_stats.latency_max = latency;
+    if(cycles > step_isr_stats.exec_max)
+        step_isr_stats.exec_max = cycles;
+
+    step_isr_stats.latency[step_isr_bucket(latency / step_isr_stats.ticks_per_us)]++;
+    step_isr_stats.exec[step_isr_bucket(cycles / hal.f_mcu)]++;
+}
+
+static void step_isr_stats_reset (void)
+{
+    hal.irq_disable();
+    memset(&step_isr_stats, 0, sizeof(step_isr_stats_t));
+    step_isr_stats.ticks_per_us = hal.f_step_timer / 1000000;
+    hal.irq_enable();
+}
+
+static void step_isr_histogram_report (const char *tag, float max, uint32_t *buckets)
+{
+    uint_fast8_t idx;
+
+    hal.stream.write(tag);
+    hal.stream.write(ftoa(max, 2));
+    for(idx = 0; idx < STEP_ISR_BUCKETS; idx++) {
+        hal.stream.write(",");
+        hal.stream.write(uitoa(buckets[idx]));
+    }
+    hal.stream.write("]" ASCII_EOL);
+}
+
+// $STEPISR reports the histograms, $STEPISR=R clears them.
+static status_code_t step_isr_stats_command (sys_state_t state, char *args)
+{
+    step_isr_stats_t stats;
+
+    if(args) {
+        if(!(*args == 'R' || *args == 'r'))
+            return Status_InvalidStatement;
+        step_isr_stats_reset();
+    } else {
+        hal.irq_disable();
+        memcpy(&stats, &step_isr_stats, sizeof(step_isr_stats_t));
+        hal.irq_enable();
+
+        hal.stream.write("[STEPISRCOUNT:");
+        hal.stream.write(uitoa(stats.count));
+        hal.stream.write("]" ASCII_EOL);
+        step_isr_histogram_report("[STEPLATENCY:", (float)stats.latency_max / (float)stats.ticks_per_us, stats.latency);
+        step_isr_histogram_report("[STEPEXEC:", (float)stats.exec_max / (float)hal.f_mcu, stats.exec);
+    }
+
+    return Status_OK;
+}
+
+#endif // STEP_ISR_STATS_ENABLE
+
 // Enable/disable limit pins interrupt
 static void limitsEnable (bool on, axes_signals_t homing_cycle)
 {
@@ -1413,77 +1953,172 @@ static void limitsEnable (bool on, axes_signals_t homing_cycle)
     } while(i);
 }
 
-// Returns limit state as an axes_signals_t variable.
-// Each bitfield bit indicates an axis limit, where triggered is 1 and not triggered is 0.
-inline IRAM_ATTR static limit_signals_t limitsGetState (void)
+/*** Input snapshot maps ***/
+
+// Limit signals are packed in the map value as min in bits 0-7, min2 in bits 8-15 and max in bits 16-23.
+#define LIMIT_MIN2_SHIFT 8
+#define LIMIT_MAX_SHIFT 16
+
+typedef struct {
+    uint32_t offset;    // input snapshot word: 0 - GPIO0-31, 1 - GPIO32-39, 2 - I2S shadow state
+    uint32_t in_mask;
+    uint32_t signal;
+} input_map_entry_t;
+
+typedef struct {
+    uint32_t n;
+    uint32_t invert;    // inversion mask for the mapped signals
+    input_map_entry_t entry[24];
+} input_map_t;
+
+static DRAM_ATTR input_map_t limit_map, control_map;
+
+static void input_map_add (input_map_t *map, uint8_t pin, uint32_t signal, bool invert)
 {
-    limit_signals_t signals = {0};
+    input_map_entry_t *entry = &map->entry[map->n++];
 
-    signals.min.mask = settings.limits.invert.mask;
-#ifdef DUAL_LIMIT_SWITCHES
-    signals.min2.mask = settings.limits.invert.mask;
-#endif
-#ifdef MAX_LIMIT_SWITCHES
-    signals.max.mask = settings.limits.invert.mask;
+#if USE_I2S_OUT
+    if(pin >= I2S_OUT_PIN_BASE) {
+        entry->offset = 2;
+        entry->in_mask = bit(pin - I2S_OUT_PIN_BASE);
+    } else
 #endif
+    {
+        entry->offset = pin >= 32 ? 1 : 0;
+        entry->in_mask = bit(pin & 0x1F);
+    }
+    entry->signal = signal;
+
+    if(invert)
+        map->invert |= signal;
+}
+
+static void input_maps_init (settings_t *settings)
+{
+    uint32_t invert = settings->limits.invert.mask;
+
+    memset(&limit_map, 0, sizeof(input_map_t));
+    memset(&control_map, 0, sizeof(input_map_t));
 
 #ifdef X_LIMIT_PIN
-    signals.min.x = DIGITAL_IN(X_LIMIT_PIN);
+    input_map_add(&limit_map, X_LIMIT_PIN, X_AXIS_BIT, invert & X_AXIS_BIT);
 #endif
 #ifdef Y_LIMIT_PIN
-    signals.min.y = DIGITAL_IN(Y_LIMIT_PIN);
+    input_map_add(&limit_map, Y_LIMIT_PIN, Y_AXIS_BIT, invert & Y_AXIS_BIT);
 #endif
 #ifdef Z_LIMIT_PIN
-    signals.min.z = DIGITAL_IN(Z_LIMIT_PIN);
+    input_map_add(&limit_map, Z_LIMIT_PIN, Z_AXIS_BIT, invert & Z_AXIS_BIT);
 #endif
 #ifdef A_LIMIT_PIN
-    signals.min.a = DIGITAL_IN(A_LIMIT_PIN);
+    input_map_add(&limit_map, A_LIMIT_PIN, A_AXIS_BIT, invert & A_AXIS_BIT);
 #endif
 #ifdef B_LIMIT_PIN
-    signals.min.b = DIGITAL_IN(B_LIMIT_PIN);
+    input_map_add(&limit_map, B_LIMIT_PIN, B_AXIS_BIT, invert & B_AXIS_BIT);
 #endif
 #ifdef C_LIMIT_PIN
-    signals.min.c = DIGITAL_IN(C_LIMIT_PIN);
+    input_map_add(&limit_map, C_LIMIT_PIN, C_AXIS_BIT, invert & C_AXIS_BIT);
 #endif
 
 #ifdef X2_LIMIT_PIN
-    signals.min2.x = DIGITAL_IN(X2_LIMIT_PIN);
+    input_map_add(&limit_map, X2_LIMIT_PIN, X_AXIS_BIT << LIMIT_MIN2_SHIFT, invert & X_AXIS_BIT);
 #endif
 #ifdef Y2_LIMIT_PIN
-    signals.min2.y = DIGITAL_IN(Y2_LIMIT_PIN);
+    input_map_add(&limit_map, Y2_LIMIT_PIN, Y_AXIS_BIT << LIMIT_MIN2_SHIFT, invert & Y_AXIS_BIT);
 #endif
 #ifdef Z2_LIMIT_PIN
-    signals.min2.z = DIGITAL_IN(Z2_LIMIT_PIN);
+    input_map_add(&limit_map, Z2_LIMIT_PIN, Z_AXIS_BIT << LIMIT_MIN2_SHIFT, invert & Z_AXIS_BIT);
 #endif
 
 #ifdef X_LIMIT_PIN_MAX
-    signals.max.x = DIGITAL_IN(X_LIMIT_PIN_MAX);
+    input_map_add(&limit_map, X_LIMIT_PIN_MAX, X_AXIS_BIT << LIMIT_MAX_SHIFT, invert & X_AXIS_BIT);
 #endif
 #ifdef Y_LIMIT_PIN_MAX
-    signals.max.y = DIGITAL_IN(Y_LIMIT_PIN_MAX);
+    input_map_add(&limit_map, Y_LIMIT_PIN_MAX, Y_AXIS_BIT << LIMIT_MAX_SHIFT, invert & Y_AXIS_BIT);
 #endif
 #ifdef Z_LIMIT_PIN_MAX
-    signals.max.z = DIGITAL_IN(Z_LIMIT_PIN_MAX);
+    input_map_add(&limit_map, Z_LIMIT_PIN_MAX, Z_AXIS_BIT << LIMIT_MAX_SHIFT, invert & Z_AXIS_BIT);
 #endif
 #ifdef A_LIMIT_PIN_MAX
-    signals.max.a = DIGITAL_IN(A_LIMIT_PIN_MAX);
+    input_map_add(&limit_map, A_LIMIT_PIN_MAX, A_AXIS_BIT << LIMIT_MAX_SHIFT, invert & A_AXIS_BIT);
 #endif
 #ifdef B_LIMIT_PIN_MAX
-    signals.max.b = DIGITAL_IN(B_LIMIT_PIN_MAX);
+    input_map_add(&limit_map, B_LIMIT_PIN_MAX, B_AXIS_BIT << LIMIT_MAX_SHIFT, invert & B_AXIS_BIT);
 #endif
 #ifdef C_LIMIT_PIN_MAX
-    signals.max.c = DIGITAL_IN(C_LIMIT_PIN_MAX);
+    input_map_add(&limit_map, C_LIMIT_PIN_MAX, C_AXIS_BIT << LIMIT_MAX_SHIFT, invert & C_AXIS_BIT);
 #endif
 
-    if(settings.limits.invert.mask) {
-        signals.min.value ^= settings.limits.invert.mask;
-#ifdef DUAL_LIMIT_SWITCHES
-        signals.min2.mask ^= settings.limits.invert.mask;
+    control_signals_t signal;
+
+#ifdef RESET_PIN
+    signal.value = 0;
+  #if ESTOP_ENABLE
+    signal.e_stop = On;
+  #else
+    signal.reset = On;
+  #endif
+    input_map_add(&control_map, RESET_PIN, signal.value, settings->control_invert.value & signal.value);
 #endif
-#ifdef MAX_LIMIT_SWITCHES
-        signals.max.value ^= settings.limits.invert.mask;
+#ifdef FEED_HOLD_PIN
+    signal.value = 0;
+    signal.feed_hold = On;
+    input_map_add(&control_map, FEED_HOLD_PIN, signal.value, settings->control_invert.value & signal.value);
 #endif
-    }
+#ifdef CYCLE_START_PIN
+    signal.value = 0;
+    signal.cycle_start = On;
+    input_map_add(&control_map, CYCLE_START_PIN, signal.value, settings->control_invert.value & signal.value);
+#endif
+#if SAFETY_DOOR_BIT || (AUX_CONTROLS_ENABLED && defined(SAFETY_DOOR_PIN))
+    signal.value = 0;
+    signal.safety_door_ajar = On;
+    input_map_add(&control_map, SAFETY_DOOR_PIN, signal.value, settings->control_invert.value & signal.value);
+#endif
+#if AUX_CONTROLS_ENABLED
+  #ifdef MOTOR_FAULT_PIN
+    signal.value = 0;
+    signal.motor_fault = On;
+    input_map_add(&control_map, MOTOR_FAULT_PIN, signal.value, settings->control_invert.value & signal.value);
+  #endif
+  #ifdef MOTOR_WARNING_PIN
+    signal.value = 0;
+    signal.motor_warning = On;
+    input_map_add(&control_map, MOTOR_WARNING_PIN, signal.value, settings->control_invert.value & signal.value);
+  #endif
+#endif
+}
+
+// Reads the input registers once and maps the snapshot to signal bits, inversion applied.
+inline __attribute__((always_inline)) IRAM_ATTR static uint32_t input_map_read (input_map_t *map)
+{
+    uint32_t in[3], value = 0, i = map->n;
+    input_map_entry_t *entry = map->entry;
+
+    in[0] = GPIO.in;
+    in[1] = GPIO.in1.data;
+#if USE_I2S_OUT
+    in[2] = i2s_out_get_state();
+#endif
+
+    if(i) do {
+        if(in[entry->offset] & entry->in_mask)
+            value |= entry->signal;
+        entry++;
+    } while(--i);
+
+    return value ^ map->invert;
+}
+
+// Returns limit state as an axes_signals_t variable.
+// Each bitfield bit indicates an axis limit, where triggered is 1 and not triggered is 0.
+inline IRAM_ATTR static limit_signals_t limitsGetState (void)
+{
+    limit_signals_t signals = {0};
+    uint32_t value = input_map_read(&limit_map);
+
+    signals.min.mask = (uint8_t)value;
+    signals.min2.mask = (uint8_t)(value >> LIMIT_MIN2_SHIFT);
+    signals.max.mask = (uint8_t)(value >> LIMIT_MAX_SHIFT);
 
     return signals;
 }
@@ -1498,51 +2133,19 @@ inline IRAM_ATTR static control_signals_t systemGetState (void)
 {
     control_signals_t signals;
 
-    signals.value = settings.control_invert.value;
-
-#ifdef RESET_PIN
-#if ESTOP_ENABLE
-    signals.e_stop = DIGITAL_IN(RESET_PIN);
-#else
-    signals.reset = DIGITAL_IN(RESET_PIN);
-#endif
-#endif
-#ifdef FEED_HOLD_PIN
-    signals.feed_hold = DIGITAL_IN(FEED_HOLD_PIN);
-#endif
-#ifdef CYCLE_START_PIN
-    signals.cycle_start = DIGITAL_IN(CYCLE_START_PIN);
-#endif
-#if SAFETY_DOOR_BIT
-    signals.safety_door_ajar = DIGITAL_IN(SAFETY_DOOR_PIN);
-#endif
+    signals.value = input_map_read(&control_map);
 
 #if AUX_CONTROLS_ENABLED
 
   #ifdef SAFETY_DOOR_PIN
     if(safety_door && debounce.safety_door)
-        signals.safety_door_ajar = !settings.control_invert.safety_door_ajar;
-    else
-        signals.safety_door_ajar = DIGITAL_IN(SAFETY_DOOR_PIN);
-  #endif
-  #ifdef MOTOR_FAULT_PIN
-    signals.motor_fault = DIGITAL_IN(MOTOR_FAULT_PIN);
-  #endif
-  #ifdef MOTOR_WARNING_PIN
-    signals.motor_warning = DIGITAL_IN(MOTOR_WARNING_PIN);
+        signals.safety_door_ajar = On;
   #endif
 
-    if(settings.control_invert.mask)
-        signals.value ^= settings.control_invert.mask;
-
   #if AUX_CONTROLS_SCAN
     signals = aux_ctrl_scan_status(signals);
   #endif
 
-#else
-    if(settings.control_invert.mask)
-        signals.value ^= settings.control_invert.mask;
-
 #endif // AUX_CONTROLS_ENABLED
 
     return signals;
@@ -1571,11 +2174,53 @@ static void probeConnectedToggle (void)
     probe.connected = !probe.connected;
 }
 
+#if PROBE_TIMESTAMP
+
+// The stepper interrupt latches the probed position from the step count on the first tick
+// after the probe edge, at that point the steps of the tick have already been output.
+// Stamp each pulse while probing so that steps output after the edge can be removed.
+// The esp_timer time base is used as the edge and the pulse may be stamped on different cores,
+// with a resolution of 1 us only steps output in a later microsecond than the edge are removed.
+IRAM_ATTR static void probePulseStart (stepper_t *stepper)
+{
+    if(sys.probing_state == Probing_Active && stepper->step_outbits.value) {
+        probe_ts.pulse = (uint32_t)esp_timer_get_time();
+        probe_ts.step_outbits = stepper->step_outbits;
+        probe_ts.dir_outbits = stepper->dir_outbits;
+    }
+
+    probe_ts.pulse_start(stepper);
+}
+
+static void probeAdjustPosition (void)
+{
+    uint_fast8_t idx;
+
+    if(!(sys.flags.probe_succeeded && probe_ts.edge_valid && probe_ts.step_outbits.value))
+        return;
+
+    if((int32_t)(probe_ts.pulse - probe_ts.edge) > 0) for(idx = 0; idx < N_AXIS; idx++) {
+        if(probe_ts.step_outbits.value & bit(idx))
+            sys.probe_position[idx] += (probe_ts.dir_outbits.value & bit(idx)) ? 1 : -1;
+    }
+}
+
+#endif // PROBE_TIMESTAMP
+
 // Sets up the probe pin invert mask to
 // appropriately set the pin logic according to setting for normal-high/normal-low operation
 // and the probing cycle modes for toward-workpiece/away-from-workpiece.
 static void probeConfigure (bool is_probe_away, bool probing)
 {
+#if PROBE_TIMESTAMP
+    if(probe_ts.pulse_start) {
+        hal.stepper.pulse_start = probe_ts.pulse_start;
+        probe_ts.pulse_start = NULL;
+        if(!probing)
+            probeAdjustPosition();
+    }
+#endif
+
 #if USE_I2S_OUT
     i2s_set_streaming_mode(!(probing || laser_mode));
 #endif
@@ -1596,6 +2241,15 @@ static void probeConfigure (bool is_probe_away, bool probing)
         probe.triggered = Off;
 
     probe.is_probing = probing;
+
+#if PROBE_TIMESTAMP
+    if(probing && probe.irq_enabled) {
+        probe_ts.edge_valid = false;
+        probe_ts.step_outbits.value = 0;
+        probe_ts.pulse_start = hal.stepper.pulse_start;
+        hal.stepper.pulse_start = probePulseStart;
+    }
+#endif
 }
 
 // Returns the probe connected and triggered pin states.
@@ -1624,6 +2278,12 @@ IRAM_ATTR static void aux_irq_handler (uint8_t port, bool state)
 #ifdef PROBE_PIN
             case Input_Probe:
                 if(probe.is_probing) {
+#if PROBE_TIMESTAMP
+                    if(!probe.triggered) {
+                        probe_ts.edge = (uint32_t)esp_timer_get_time();
+                        probe_ts.edge_valid = true;
+                    }
+#endif
                     probe.triggered = On;
                     return;
                 } else
@@ -1730,9 +2390,17 @@ IRAM_ATTR inline static void spindle_dir (bool ccw)
 #endif
 }
 
+#if PPI_ENABLE
+static volatile bool ppi_pulse = false; // laser PPI pulse on, cleared when the spindle state is set
+#endif
+
 // Start or stop spindle
 IRAM_ATTR static void spindleSetState (spindle_ptrs_t *spindle, spindle_state_t state, float rpm)
 {
+#if PPI_ENABLE
+    ppi_pulse = false;
+#endif
+
     if (!state.on)
         spindle_off();
     else {
@@ -1784,11 +2452,121 @@ IRAM_ATTR static void spindleSetSpeed (spindle_ptrs_t *spindle, uint_fast16_t pw
     }
 }
 
-static uint_fast16_t spindleGetPWM (spindle_ptrs_t *spindle, float rpm)
+#if SPINDLE_PWM_LUT_SIZE
+
+static void spindle_pwm_lut_build (spindle_pwm_t *pwm_data, spindle_settings_t *spindle)
 {
+    uint_fast16_t idx;
+
+    spindle_pwm_lut.valid = false;
+    spindle_pwm_lut.rpm_min = spindle->rpm_min;
+    spindle_pwm_lut.rpm_max = spindle->rpm_max;
+    spindle_pwm_lut.scale = (float)(SPINDLE_PWM_LUT_SIZE << SPINDLE_PWM_LUT_FRAC_BITS) / (spindle->rpm_max - spindle->rpm_min);
+    spindle_pwm_lut.off_value = (uint16_t)pwm_data->off_value;
+    spindle_pwm_lut.value[0] = spindle_pwm_lut.min_value = (uint16_t)pwm_data->min_value;
+
+    for(idx = 1; idx <= SPINDLE_PWM_LUT_SIZE; idx++)
+        spindle_pwm_lut.value[idx] = (uint16_t)pwm_data->compute_value(pwm_data, spindle->rpm_min + (spindle->rpm_max - spindle->rpm_min) * (float)idx / (float)SPINDLE_PWM_LUT_SIZE, false);
+
+    spindle_pwm_lut.valid = pwm_max_value <= UINT16_MAX;
+}
+
+IRAM_ATTR static uint_fast16_t spindle_pwm_lut_get (float rpm)
+{
+    if(rpm <= 0.0f)
+        return spindle_pwm_lut.off_value;
+
+    if(rpm <= spindle_pwm_lut.rpm_min)
+        return spindle_pwm_lut.min_value;
+
+    if(rpm >= spindle_pwm_lut.rpm_max)
+        return spindle_pwm_lut.value[SPINDLE_PWM_LUT_SIZE];
+
+    uint32_t pos = (uint32_t)((rpm - spindle_pwm_lut.rpm_min) * spindle_pwm_lut.scale),
+             idx = pos >> SPINDLE_PWM_LUT_FRAC_BITS;
+    int32_t value = spindle_pwm_lut.value[idx];
+
+    return (uint_fast16_t)(value + (((spindle_pwm_lut.value[idx + 1] - value) * (int32_t)(pos & ((1 << SPINDLE_PWM_LUT_FRAC_BITS) - 1))) >> SPINDLE_PWM_LUT_FRAC_BITS));
+}
+
+#endif // SPINDLE_PWM_LUT_SIZE
+
+IRAM_ATTR static uint_fast16_t spindleGetPWM (spindle_ptrs_t *spindle, float rpm)
+{
+#if SPINDLE_PWM_LUT_SIZE
+    if(spindle_pwm_lut.valid && spindle->context.pwm == &spindle_pwm)
+        return spindle_pwm_lut_get(rpm);
+#endif
+
     return spindle->context.pwm->compute_value(spindle->context.pwm, rpm, false);
 }
 
+#if PPI_ENABLE
+
+// Laser PPI (pulses per inch), the PPI plugin fires a pulse from the stepper interrupt every
+// N steps of travel with the pulse length calculated once per block. The laser is switched on
+// here and off again by a one-shot alarm of a free running general purpose timer.
+
+#ifndef PPI_TIMER_GROUP
+#define PPI_TIMER_GROUP TIMER_GROUP_1
+#endif
+#ifndef PPI_TIMER_INDEX
+#define PPI_TIMER_INDEX TIMER_0
+#endif
+#define PPI_TIMER_PRESCALER 80 // 1 MHz, pulse lengths are in microseconds
+#define PPI_PULSE_MIN 2        // microseconds, the alarm must be set ahead of the counter value read
+
+#if USE_I2S_OUT
+_Static_assert(SPINDLE_ENABLE_PIN < I2S_OUT_PIN_BASE, "Laser PPI requires the spindle enable signal on a GPIO pin, not an I2S output!");
+#endif
+
+// The spindle is left as is if its state has been set since the pulse was started,
+// e.g. when PPI is disabled mid-pulse with the spindle on.
+IRAM_ATTR static void ppi_timer_isr (void *arg)
+{
+    timer_group_clr_intr_status_in_isr(PPI_TIMER_GROUP, PPI_TIMER_INDEX);
+
+    if(ppi_pulse) {
+        ppi_pulse = false;
+        spindle_off();
+    }
+}
+
+IRAM_ATTR static void spindlePulseOn (spindle_ptrs_t *spindle, uint_fast16_t pulse_length)
+{
+    if(pulse_length == 0) {
+        // No pulse, end any pulse in progress. A pending alarm is then ignored.
+        ppi_pulse = false;
+        spindle_off();
+        return;
+    }
+
+    timer_group_set_alarm_value_in_isr(PPI_TIMER_GROUP, PPI_TIMER_INDEX, timer_group_get_counter_value_in_isr(PPI_TIMER_GROUP, PPI_TIMER_INDEX) + max(pulse_length, PPI_PULSE_MIN));
+    timer_group_enable_alarm_in_isr(PPI_TIMER_GROUP, PPI_TIMER_INDEX);
+
+    ppi_pulse = true;
+    spindle_on();
+}
+
+static void ppi_timer_init (void)
+{
+    timer_config_t timerConfig = {
+        .divider     = PPI_TIMER_PRESCALER,
+        .counter_dir = TIMER_COUNT_UP,
+        .counter_en  = TIMER_START,
+        .alarm_en    = TIMER_ALARM_DIS,
+        .intr_type   = TIMER_INTR_LEVEL,
+        .auto_reload = false
+    };
+
+    timer_init(PPI_TIMER_GROUP, PPI_TIMER_INDEX, &timerConfig);
+    timer_set_counter_value(PPI_TIMER_GROUP, PPI_TIMER_INDEX, 0ULL);
+    timer_isr_register(PPI_TIMER_GROUP, PPI_TIMER_INDEX, ppi_timer_isr, 0, ESP_INTR_FLAG_IRAM, NULL);
+    timer_enable_intr(PPI_TIMER_GROUP, PPI_TIMER_INDEX);
+}
+
+#endif // PPI_ENABLE
+
 // Start or stop spindle, variable version
 
 IRAM_ATTR static void spindleOff (spindle_ptrs_t *spindle)
@@ -1800,6 +2578,9 @@ IRAM_ATTR static void spindleOff (spindle_ptrs_t *spindle)
 
 IRAM_ATTR static void spindleSetStateVariable (spindle_ptrs_t *spindle, spindle_state_t state, float rpm)
 {
+#if PPI_ENABLE
+    ppi_pulse = false;
+#endif
 #ifdef SPINDLE_DIRECTION_PIN
     if(state.on || spindle->context.pwm->cloned)
         spindle_dir(state.ccw);
@@ -1812,7 +2593,7 @@ IRAM_ATTR static void spindleSetStateVariable (spindle_ptrs_t *spindle, spindle_
     }
 
     spindleSetSpeed(spindle, state.on || (state.ccw && spindle->context.pwm->cloned)
-                              ? spindle->context.pwm->compute_value(spindle->context.pwm, rpm, false)
+                              ? spindleGetPWM(spindle, rpm)
                               : spindle->context.pwm->off_value);
 }
 
@@ -1846,30 +2627,267 @@ bool spindleConfig (spindle_ptrs_t *spindle)
             }
         }
 
-        pwm_max_value = (1UL << spindle_pwm_timer.duty_resolution) - 1;
-        spindle_pwm.offset = (settings.spindle.invert.pwm ? -1 : 1);
-        spindle_precompute_pwm_values(spindle, &spindle_pwm, &settings.spindle, pwm_max_value * settings.spindle.pwm_freq);
+        pwm_max_value = (1UL << spindle_pwm_timer.duty_resolution) - 1;
+        spindle_pwm.offset = (settings.spindle.invert.pwm ? -1 : 1);
+        spindle_precompute_pwm_values(spindle, &spindle_pwm, &settings.spindle, pwm_max_value * settings.spindle.pwm_freq);
+#if SPINDLE_PWM_LUT_SIZE
+        spindle_pwm_lut_build(&spindle_pwm, &settings.spindle);
+#endif
+
+        ledc_set_freq(spindle_pwm_timer.speed_mode, spindle_pwm_timer.timer_num, spindle_pwm_timer.freq_hz);
+
+    } else {
+#if SPINDLE_PWM_LUT_SIZE
+        spindle_pwm_lut.valid = false;
+#endif
+        if(pwmEnabled)
+            spindle->set_state(spindle, (spindle_state_t){0}, 0.0f);
+        spindle->esp32_off = spindleOffBasic;
+        spindle->set_state = spindleSetState;
+    }
+
+    spindle_update_caps(spindle, spindle->cap.variable ? &spindle_pwm : NULL);
+
+#if USE_I2S_OUT
+    if(spindle->id == spindle_get_default())
+        i2s_set_streaming_mode(!(laser_mode = spindle->cap.laser));
+#endif
+
+    return true;
+}
+
+#endif // DRIVER_SPINDLE_PWM_ENABLE
+
+#if SPINDLE_ENCODER_ENABLE
+
+/*** Spindle encoder ***/
+
+// Pulses, or all edges of a quadrature encoder, are counted by a PCNT unit.
+// The index pulse interrupt records the count and a timestamp, the angular position is
+// referenced to the last index pulse when available to avoid accumulating count errors.
+// The RPM estimate is updated by a periodic timer and smoothed by a first order filter.
+
+#ifndef SPINDLE_ENCODER_PCNT_UNIT
+#define SPINDLE_ENCODER_PCNT_UNIT PCNT_UNIT_0
+#endif
+#ifndef SPINDLE_ENCODER_FILTER
+#define SPINDLE_ENCODER_FILTER 100 // APB clock cycles, 1.25 us
+#endif
+#ifdef SPINDLE_PULSE_B_PIN
+#define SPINDLE_ENCODER_COUNTS_PER_PULSE 4
+#else
+#define SPINDLE_ENCODER_COUNTS_PER_PULSE 1
+#endif
+#define SPINDLE_RPM_SAMPLE_US 10000
+#define SPINDLE_STOPPED_US 250000   // RPM is reported as 0 if no pulses are seen within this time
+
+typedef struct {
+    pcnt_encoder_t counter;
+    uint32_t counts_per_rev;
+    float pulse_distance;           // revolutions per count
+    float rpm;                      // filtered RPM estimate
+    int32_t count_at_reset;
+    int32_t last_count;             // count at last RPM update
+    int64_t last_sample;            // time of last RPM update, microseconds
+    volatile uint32_t index_count;  // index pulses since reset
+    volatile int32_t count_at_index;
+    volatile int64_t index_time;    // time of last index pulse, microseconds
+    volatile uint32_t index_period; // microseconds between the last two index pulses
+    esp_timer_handle_t sampler;
+    spindle_data_t data;
+} spindle_pcnt_encoder_t;
+
+static spindle_pcnt_encoder_t spindle_encoder = {0};
+static on_spindle_programmed_ptr on_spindle_programmed = NULL;
+
+static void spindleRPMSample (void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    int32_t count = pcnt_encoder_get_count(&spindle_encoder.counter);
+
+#ifdef SPINDLE_INDEX_PIN
+    // Use the count and timestamp latched by the last index pulse if there is one since the last update,
+    // these are not skewed by the latency of the sampler task.
+    disable_irq();
+    if(spindle_encoder.index_time > spindle_encoder.last_sample) {
+        now = spindle_encoder.index_time;
+        count = spindle_encoder.count_at_index;
+    }
+    enable_irq();
+#endif
+
+    int64_t elapsed = now - spindle_encoder.last_sample;
+    int32_t delta = count - spindle_encoder.last_count;
+
+    // Wait for at least one count unless stopped, improves resolution at low speeds and pulse rates.
+    if(spindle_encoder.counts_per_rev == 0 || (delta == 0 && elapsed < SPINDLE_STOPPED_US))
+        return;
+
+    float rpm = (float)abs(delta) * 60000000.0f / ((float)spindle_encoder.counts_per_rev * (float)elapsed),
+          tau = (float)driver_settings.spindle_rpm_filter * 1000.0f;
+
+    spindle_encoder.rpm += ((float)elapsed / (tau + (float)elapsed)) * (rpm - spindle_encoder.rpm);
+    spindle_encoder.last_count = count;
+    spindle_encoder.last_sample = now;
+}
+
+#ifdef SPINDLE_INDEX_PIN
+
+// Called from the GPIO interrupt handlers, everything called from here must be IRAM resident.
+IRAM_ATTR static void spindleIndexEvent (void)
+{
+    int64_t now = esp_timer_get_time();
+    int32_t count = pcnt_encoder_get_count(&spindle_encoder.counter);
+
+    if(spindle_encoder.index_count && pcnt_count_index_error(count, spindle_encoder.count_at_index, spindle_encoder.counts_per_rev, SPINDLE_ENCODER_COUNTS_PER_PULSE))
+        spindle_encoder.data.error_count++;
+
+    if(spindle_encoder.index_time)
+        spindle_encoder.index_period = (uint32_t)(now - spindle_encoder.index_time);
+
+    spindle_encoder.count_at_index = count;
+    spindle_encoder.index_time = now;
+    spindle_encoder.index_count++;
+}
+
+#endif
+
+static spindle_data_t *spindleGetData (spindle_data_request_t request)
+{
+    uint32_t index_count;
+    int32_t count, count_at_index;
+
+    switch(request) {
+
+        case SpindleData_Counters:
+            spindle_encoder.data.pulse_count = (uint32_t)abs(pcnt_encoder_get_count(&spindle_encoder.counter) - spindle_encoder.count_at_reset);
+            spindle_encoder.data.index_count = spindle_encoder.index_count;
+            break;
+
+        case SpindleData_RPM:
+            spindle_encoder.data.rpm = spindle_encoder.rpm;
+            break;
+
+        case SpindleData_AngularPosition:
+            disable_irq();
+            count = pcnt_encoder_get_count(&spindle_encoder.counter);
+            index_count = spindle_encoder.index_count;
+            count_at_index = spindle_encoder.count_at_index;
+            enable_irq();
+            spindle_encoder.data.angular_position = pcnt_count_angular_position(index_count, count, count_at_index, spindle_encoder.pulse_distance);
+            break;
+
+        default:
+            break;
+    }
+
+    return &spindle_encoder.data;
+}
+
+static void spindleDataReset (void)
+{
+    disable_irq();
+    spindle_encoder.count_at_reset = spindle_encoder.count_at_index = pcnt_encoder_get_count(&spindle_encoder.counter);
+    spindle_encoder.index_count = 0;
+    enable_irq();
+
+    spindle_encoder.data.pulse_count = spindle_encoder.data.index_count = spindle_encoder.data.error_count = 0;
+    spindle_encoder.data.angular_position = 0.0f;
+}
+
+static void onSpindleProgrammed (spindle_ptrs_t *spindle, spindle_state_t state, float rpm, spindle_rpm_mode_t mode)
+{
+    if(on_spindle_programmed)
+        on_spindle_programmed(spindle, state, rpm, mode);
+
+    if(spindle->get_data == spindleGetData) {
+        spindle_set_at_speed_range(spindle, &spindle_encoder.data, rpm);
+        spindle_encoder.data.state_programmed.on = state.on;
+        spindle_encoder.data.state_programmed.ccw = state.ccw;
+    }
+}
+
+static void spindleEncoderConfig (settings_t *settings)
+{
+    uint32_t counts_per_rev = settings->spindle.ppr * SPINDLE_ENCODER_COUNTS_PER_PULSE;
+
+    if(spindle_encoder.counts_per_rev != counts_per_rev) {
+        spindle_encoder.counts_per_rev = counts_per_rev;
+        spindle_encoder.pulse_distance = counts_per_rev ? 1.0f / (float)counts_per_rev : 0.0f;
+        spindle_encoder.rpm = 0.0f;
+        spindleDataReset();
+    }
+}
+
+static bool spindleEncoderInit (void)
+{
+#ifdef SPINDLE_PULSE_B_PIN
+    if(!pcnt_encoder_init(&spindle_encoder.counter, SPINDLE_ENCODER_PCNT_UNIT, SPINDLE_PULSE_PIN, SPINDLE_PULSE_B_PIN, SPINDLE_ENCODER_FILTER))
+#else
+    if(!pcnt_encoder_init(&spindle_encoder.counter, SPINDLE_ENCODER_PCNT_UNIT, SPINDLE_PULSE_PIN, PCNT_ENCODER_NO_PIN, SPINDLE_ENCODER_FILTER))
+#endif
+        return false;
+
+    esp_timer_create_args_t args = {
+        .callback = spindleRPMSample,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "spindle rpm"
+    };
+
+    spindle_encoder.last_sample = esp_timer_get_time();
 
-        ledc_set_freq(spindle_pwm_timer.speed_mode, spindle_pwm_timer.timer_num, spindle_pwm_timer.freq_hz);
+    if(esp_timer_create(&args, &spindle_encoder.sampler) != ESP_OK ||
+        esp_timer_start_periodic(spindle_encoder.sampler, SPINDLE_RPM_SAMPLE_US) != ESP_OK)
+        return false;
 
-    } else {
-        if(pwmEnabled)
-            spindle->set_state(spindle, (spindle_state_t){0}, 0.0f);
-        spindle->esp32_off = spindleOffBasic;
-        spindle->set_state = spindleSetState;
-    }
+    static const periph_pin_t pulse = {
+        .function = Input_SpindlePulse,
+        .group = PinGroup_SpindlePulse,
+        .pin = SPINDLE_PULSE_PIN,
+        .mode = { .mask = PINMODE_NONE }
+    };
 
-    spindle_update_caps(spindle, spindle->cap.variable ? &spindle_pwm : NULL);
+    hal.periph_port.register_pin(&pulse);
 
-#if USE_I2S_OUT
-    if(spindle->id == spindle_get_default())
-        i2s_set_streaming_mode(!(laser_mode = spindle->cap.laser));
+#ifdef SPINDLE_PULSE_B_PIN
+    static const periph_pin_t pulse_b = {
+        .function = Input_SpindlePulse,
+        .group = PinGroup_SpindlePulse,
+        .pin = SPINDLE_PULSE_B_PIN,
+        .mode = { .mask = PINMODE_NONE },
+        .description = "Phase B"
+    };
+
+    hal.periph_port.register_pin(&pulse_b);
 #endif
 
+    on_spindle_programmed = grbl.on_spindle_programmed;
+    grbl.on_spindle_programmed = onSpindleProgrammed;
+
     return true;
 }
 
-#endif // DRIVER_SPINDLE_PWM_ENABLE
+// $SPINDLEENC reports encoder count, index count, time of and time between the last index pulses and RPM.
+static status_code_t spindle_encoder_command (sys_state_t state, char *args)
+{
+    hal.stream.write("[SPINDLEENC:");
+    hal.stream.write(uitoa((uint32_t)abs(pcnt_encoder_get_count(&spindle_encoder.counter) - spindle_encoder.count_at_reset)));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(spindle_encoder.index_count));
+    hal.stream.write(",");
+    hal.stream.write(uitoa((uint32_t)spindle_encoder.index_time));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(spindle_encoder.index_period));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(spindle_encoder.rpm, 1));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(spindle_encoder.data.error_count));
+    hal.stream.write("]" ASCII_EOL);
+
+    return Status_OK;
+}
+
+#endif // SPINDLE_ENCODER_ENABLE
 
 // Returns spindle state in a spindle_state_t variable
 static spindle_state_t spindleGetState (spindle_ptrs_t *spindle)
@@ -1896,6 +2914,11 @@ static spindle_state_t spindleGetState (spindle_ptrs_t *spindle)
     state.at_speed = ledc_get_duty(spindle_pwm_channel.speed_mode, spindle_pwm_channel.channel) == pwm_ramp.pwm_target;
   #endif
 #endif
+#if SPINDLE_ENCODER_ENABLE
+    if(spindle_encoder.counts_per_rev)
+        state.at_speed = settings.spindle.at_speed_tolerance <= 0.0f ||
+                          (spindle_encoder.rpm >= spindle_encoder.data.rpm_low_limit && spindle_encoder.rpm <= spindle_encoder.data.rpm_high_limit);
+#endif
 
     return state;
 }
@@ -2011,6 +3034,109 @@ gpio_int_type_t map_intr_type (pin_irq_mode_t mode)
     return GPIO_INTR_DISABLE;
 }
 
+/*** Input debounce ***/
+
+// Each debounced input has its own one-shot timer, started on the first edge with the
+// pin interrupt disabled. The timeout runs in the esp_timer task, it only samples the input
+// for the glitch counter and hands it over to the foreground process where the input is
+// handled and the interrupt re-enabled, as is done by the delayed task used if no timer
+// is available.
+
+inline static bool pin_is_active (input_signal_t *input)
+{
+    return input->mode.irq_mode == IRQ_Mode_Change ||
+            DIGITAL_IN(input->pin) == (input->mode.irq_mode == IRQ_Mode_Falling ? 0 : 1);
+}
+
+static void pin_debounce_timeout (void *arg)
+{
+    input_debounce_t *db = (input_debounce_t *)arg;
+
+    if(!pin_is_active(db->input))
+        db->glitches++;
+
+    // Try again later if the foreground task queue is full.
+    if(!protocol_enqueue_foreground_task(pin_debounce, db->input))
+        esp_timer_start_once(db->timer, db->window);
+}
+
+inline static uint32_t pin_debounce_window (input_signal_t *input)
+{
+    return (input->group & (PinGroup_Limit|PinGroup_LimitMax)) ? driver_settings.limit_debounce : driver_settings.control_debounce;
+}
+
+// A debounce window in progress is left to complete when reconfigured.
+static void pin_debounce_config (uint_fast8_t idx, input_signal_t *input)
+{
+    input_debounce_t *db = &input_debounce[idx];
+
+    db->input = input;
+    db->window = input->mode.debounce ? pin_debounce_window(input) : 0;
+
+    if(db->window && db->timer == NULL) {
+
+        esp_timer_create_args_t args = {
+            .callback = pin_debounce_timeout,
+            .arg = db,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "debounce"
+        };
+
+        if(esp_timer_create(&args, &db->timer) != ESP_OK)
+            db->timer = NULL;
+    }
+}
+
+// Returns true if a debounce window was started, the caller should then not act on the edge.
+IRAM_ATTR static bool pin_debounce_start (input_signal_t *input)
+{
+    input_debounce_t *db = &input_debounce[input - inputpin];
+
+    if(db->window == 0)
+        return false;
+
+    gpio_intr_disable(input->pin);
+
+    if(!(db->timer && esp_timer_start_once(db->timer, db->window) == ESP_OK) &&
+        !task_add_delayed(pin_debounce, input, (db->window + 999) / 1000)) {
+        gpio_intr_enable(input->pin);
+        return false;
+    }
+
+    db->events++;
+
+#if SAFETY_DOOR_ENABLE
+    if(input->id == Input_SafetyDoor)
+        debounce.safety_door = On;
+#endif
+
+    return true;
+}
+
+// $DEBOUNCE reports pin, window, edge and glitch counts for the debounced inputs.
+static status_code_t debounce_command (sys_state_t state, char *args)
+{
+    uint_fast8_t idx;
+    input_debounce_t *db;
+
+    for(idx = 0; idx < sizeof(input_debounce) / sizeof(input_debounce_t); idx++) {
+        db = &input_debounce[idx];
+        if(db->input && db->window) {
+            hal.stream.write("[DEBOUNCE:");
+            hal.stream.write(uitoa(db->input->pin));
+            hal.stream.write(",");
+            hal.stream.write(uitoa(db->window));
+            hal.stream.write(",");
+            hal.stream.write(uitoa(db->events));
+            hal.stream.write(",");
+            hal.stream.write(uitoa(db->glitches));
+            hal.stream.write("]" ASCII_EOL);
+        }
+    }
+
+    return Status_OK;
+}
+
 // Configures perhipherals when settings are initialized or changed
 static void settings_changed (settings_t *settings, settings_changed_flags_t changed)
 {
@@ -2025,16 +3151,8 @@ static void settings_changed (settings_t *settings, settings_changed_flags_t cha
         else
             hal.rgb0.num_devices = settings->rgb_strip0_length;
 
-        if(neopixel.leds) {
-            free(neopixel.leds);
-            neopixel.leds = NULL;
-        }
-
-        if(hal.rgb0.num_devices) {
-            neopixel.num_bytes = hal.rgb0.num_devices * 3;
-            if((neopixel.leds = calloc(neopixel.num_bytes, sizeof(uint8_t))) == NULL)
-                hal.rgb0.num_devices = 0;
-        }
+        if(!neopixels_alloc(hal.rgb0.num_devices))
+            hal.rgb0.num_devices = 0;
 
         neopixel.num_leds = hal.rgb0.num_devices;
     }
@@ -2049,6 +3167,10 @@ static void settings_changed (settings_t *settings, settings_changed_flags_t cha
         }
 #endif
 
+#if SPINDLE_ENCODER_ENABLE
+        spindleEncoderConfig(settings);
+#endif
+
 #if BLUETOOTH_ENABLE
         static bool bluetooth_ok = false;
         if(!bluetooth_ok)
@@ -2070,6 +3192,8 @@ static void settings_changed (settings_t *settings, settings_changed_flags_t cha
          * Step pulse config *
          *********************/
 
+        out_masks_init(settings);
+
 #if USE_I2S_OUT
 
         i2s_delay_length = (uint32_t)ceilf(settings->steppers.pulse_delay_microseconds);
@@ -2078,16 +3202,22 @@ static void settings_changed (settings_t *settings, settings_changed_flags_t cha
         if(i2s_delay_length % I2S_OUT_USEC_PER_PULSE)
             i2s_delay_length += I2S_OUT_USEC_PER_PULSE - i2s_delay_length % I2S_OUT_USEC_PER_PULSE;
 
-        i2s_delay_length = min(max(i2s_delay_length, I2S_OUT_USEC_PER_PULSE), I2S_OUT_USEC_PER_PULSE * 2);
+        i2s_delay_length = min(max(i2s_delay_length, I2S_OUT_USEC_PER_PULSE), I2S_OUT_USEC_PER_PULSE * I2S_OUT_DELAY_SAMPLES_MAX);
 
         if(i2s_step_length % I2S_OUT_USEC_PER_PULSE)
             i2s_step_length += I2S_OUT_USEC_PER_PULSE - i2s_step_length % I2S_OUT_USEC_PER_PULSE;
 
-        i2s_step_length = min(max(i2s_step_length, I2S_OUT_USEC_PER_PULSE), I2S_OUT_USEC_PER_PULSE * 4);
+        i2s_step_length = min(max(i2s_step_length, I2S_OUT_USEC_PER_PULSE), I2S_OUT_USEC_PER_PULSE * I2S_OUT_PULSE_SAMPLES_MAX);
 
         i2s_delay_samples = i2s_delay_length / I2S_OUT_USEC_PER_PULSE;
         i2s_step_samples = i2s_step_length / I2S_OUT_USEC_PER_PULSE;
 
+  #if !CONFIG_IDF_TARGET_ESP32S3
+        i2s_pulse.delay_ticks = (i2s_delay_length + 1) * (hal.f_step_timer / 1000000);
+        i2s_pulse.pulse_ticks = (i2s_step_length + 1) * (hal.f_step_timer / 1000000);
+        i2s_pulse.min_period = i2s_pulse.pulse_ticks + max(i2s_pulse.delay_ticks, i2s_pulse.pulse_ticks);
+  #endif
+
 //        hal.max_step_rate = 250000UL / (i2s_delay_samples + i2s_step_samples);
 
 #else
@@ -2109,6 +3239,10 @@ static void settings_changed (settings_t *settings, settings_changed_flags_t cha
 
         uint32_t i = sizeof(inputpin) / sizeof(input_signal_t);
 
+#if !ETHERNET_ENABLE
+        memset(gpio_dispatch, 0, sizeof(gpio_dispatch));
+#endif
+
         while(i--) {
 
             signal = &inputpin[i];
@@ -2214,6 +3348,16 @@ static void settings_changed (settings_t *settings, settings_changed_flags_t cha
                     break;
  #endif
 #endif // AUX_DEVICES
+#if SPINDLE_ENCODER_ENABLE && defined(SPINDLE_INDEX_PIN)
+                case Input_SpindleIndex:
+                    signal->mode.pull_mode = PullMode_Up;
+                    signal->mode.inverted = false;
+                    signal->mode.irq_mode = IRQ_Mode_Rising;
+  #if ETHERNET_ENABLE
+                    gpio_isr_handler_add(signal->pin, gpio_spindle_index_isr, signal);
+  #endif
+                    break;
+#endif
                 default:
                     break;
             }
@@ -2262,9 +3406,16 @@ static void settings_changed (settings_t *settings, settings_changed_flags_t cha
     //            printf("IN %d - %d - %d : %x\n", signal->pin,  signal->offset, signal->mask, signal->invert);
 
                 gpio_config(&config);
+#if !ETHERNET_ENABLE
+                signal->dispatch_next = gpio_dispatch[signal->pin];
+                gpio_dispatch[signal->pin] = signal;
+#endif
+                pin_debounce_config(i, signal);
             }
         }
 
+        input_maps_init(settings);
+
         hal.limits.enable(settings->limits.flags.hard_enabled, (axes_signals_t){0});
 
 #if AUX_CONTROLS_ENABLED
@@ -2460,6 +3611,7 @@ static rmt_config_t neo_config = RMT_DEFAULT_CONFIG_TX(NEOPIXELS_PIN, 7);
 #define WS2812_T0L_NS (850)
 #define WS2812_T1H_NS (800)
 #define WS2812_T1L_NS (450)
+#define WS2812_RESET_NS (60000)
 /*
 #define WS2812_T0H_NS (350)
 #define WS2812_T0L_NS (1000)
@@ -2472,63 +3624,141 @@ static rmt_config_t neo_config = RMT_DEFAULT_CONFIG_TX(NEOPIXELS_PIN, 7);
 #define WS2812_T1L_NS (1300)
 */
 
-static uint32_t t0h_ticks = 0, t1h_ticks = 0, t0l_ticks = 0, t1l_ticks = 0;
+// The strip is encoded to RMT items in a back buffer, only the pixels changed since the last
+// write are encoded. The buffers are swapped and transmission started without waiting for
+// completion, if a transmission is in progress the swap is deferred to the end of it.
+// Intensity is applied via a lookup table when encoding.
+
+#define NEOPIXEL_ITEMS(n) ((n) * 24)
+
+typedef struct {
+    rmt_item32_t *item[2];      // encoded strip, item[front] is owned by the RMT driver when transmitting
+    uint_fast8_t front;
+    uint16_t dirty_first;       // pixels changed since last encoded, none if first > last
+    uint16_t dirty_last;
+    uint16_t sync_first;        // pixels encoded to the back buffer since last swap
+    uint16_t sync_last;
+    volatile bool pending;      // back buffer has changes not yet transmitted
+    rmt_item32_t bit[2];
+    rmt_item32_t reset;
+    uint8_t lut[256];
+} neopixel_strip_t;
+
+static neopixel_strip_t strip = {
+    .dirty_first = UINT16_MAX,
+    .sync_first = UINT16_MAX
+};
+
+static void neopixels_set_lut (uint8_t intensity)
+{
+    uint_fast16_t value = 0;
+
+    do {
+        strip.lut[value] = rgb_set_intensity((rgb_color_t){ .R = value }, intensity).R;
+    } while(++value < 256);
+}
 
-static void IRAM_ATTR ws2812_rmt_adapter (const void *src, rmt_item32_t *dest, size_t src_size,
-                                           size_t wanted_num, size_t *translated_size, size_t *item_num)
+static bool neopixels_alloc (uint16_t num_leds)
 {
-    const rmt_item32_t bit0 = {{{ t0h_ticks, 1, t0l_ticks, 0 }}}; //Logical 0
-    const rmt_item32_t bit1 = {{{ t1h_ticks, 1, t1l_ticks, 0 }}}; //Logical 1
+    uint_fast8_t idx;
 
-    rgb_color_t color = {0};
-    size_t size = 0, num = 0;
-    uint8_t *psrc = (uint8_t *)src, bitmask;
+    rmt_wait_tx_done(neo_config.channel, portMAX_DELAY);
 
-    if(!(src == NULL || dest == NULL)) {
-        while(size < src_size && num < wanted_num) {
+    strip.pending = false;
+    strip.dirty_first = strip.sync_first = UINT16_MAX;
+    strip.dirty_last = strip.sync_last = 0;
 
-            color.G = *psrc++;
-            color.R = *psrc++;
-            color.B = *psrc++;
-            color = rgb_set_intensity(color, neopixel.intensity);
+    if(neopixel.leds) {
+        free(neopixel.leds);
+        neopixel.leds = NULL;
+    }
 
-            bitmask = 0b10000000;
-            do {
-                dest->val = color.G & bitmask ? bit1.val : bit0.val;
-                dest++;
-            } while(bitmask >>= 1);
+    for(idx = 0; idx < 2; idx++) {
+        if(strip.item[idx]) {
+            free(strip.item[idx]);
+            strip.item[idx] = NULL;
+        }
+    }
 
-            bitmask = 0b10000000;
-            do {
-                dest->val = color.R & bitmask ? bit1.val : bit0.val;
-                dest++;
-            } while(bitmask >>= 1);
+    if(num_leds == 0)
+        return true;
 
-            bitmask = 0b10000000;
-            do {
-                dest->val = color.B & bitmask ? bit1.val : bit0.val;
-                dest++;
-            } while(bitmask >>= 1);
+    neopixel.num_bytes = num_leds * 3;
+    if((neopixel.leds = calloc(neopixel.num_bytes, sizeof(uint8_t))) == NULL)
+        return false;
 
-            num += 24;
-            size += 3;
+    // Allocated in internal RAM as the RMT interrupt reads from the front buffer
+    for(idx = 0; idx < 2; idx++) {
+        if((strip.item[idx] = heap_caps_malloc((NEOPIXEL_ITEMS(num_leds) + 1) * sizeof(rmt_item32_t), MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT)) == NULL) {
+            neopixels_alloc(0);
+            return false;
         }
+        strip.item[idx][NEOPIXEL_ITEMS(num_leds)] = strip.reset;
+    }
+
+    strip.dirty_first = 0;
+    strip.dirty_last = num_leds - 1;
+
+    return true;
+}
+
+static void neopixels_encode (rmt_item32_t *item, uint_fast16_t first, uint_fast16_t last)
+{
+    uint8_t *led = &neopixel.leds[first * 3], *end = &neopixel.leds[(last + 1) * 3], value, bitmask;
+
+    item += NEOPIXEL_ITEMS(first);
+
+    // Bytes are stored in transmission (GRB) order
+    while(led < end) {
+        value = strip.lut[*led++];
+        bitmask = 0b10000000;
+        do {
+            *item++ = strip.bit[(value & bitmask) != 0];
+        } while(bitmask >>= 1);
+    }
+}
+
+static void neopixels_flush (void *data)
+{
+    if(strip.pending && rmt_wait_tx_done(neo_config.channel, 0) == ESP_OK) {
+
+        strip.pending = false;
+        strip.front ^= 1;
+
+        rmt_write_items(neo_config.channel, strip.item[strip.front], NEOPIXEL_ITEMS(neopixel.num_leds) + 1, false);
+
+        // Bring the new back buffer up to date, the front buffer is only read by the RMT driver
+        memcpy(&strip.item[strip.front ^ 1][NEOPIXEL_ITEMS(strip.sync_first)], &strip.item[strip.front][NEOPIXEL_ITEMS(strip.sync_first)],
+                NEOPIXEL_ITEMS(strip.sync_last - strip.sync_first + 1) * sizeof(rmt_item32_t));
+
+        strip.sync_first = UINT16_MAX;
+        strip.sync_last = 0;
     }
+}
 
-    *translated_size = size;
-    *item_num = num;
+IRAM_ATTR static void neopixels_tx_end (rmt_channel_t channel, void *arg)
+{
+    if(channel == neo_config.channel && strip.pending)
+        protocol_enqueue_foreground_task(neopixels_flush, NULL);
 }
 
 void neopixels_write (void)
 {
-    uint8_t *buf = neopixel.leds;
-    size_t size = neopixel.num_bytes;
+    if(neopixel.leds == NULL)
+        return;
 
-    if(buf) do {
-        rmt_write_sample(neo_config.channel, buf, size > 6 ? 6 : size, true);
-        buf += size > 6 ? 6 : size;
-        size -= size > 6 ? 6 : size;
-    } while(size);
+    if(strip.dirty_first <= strip.dirty_last) {
+
+        neopixels_encode(strip.item[strip.front ^ 1], strip.dirty_first, strip.dirty_last);
+
+        strip.sync_first = min(strip.sync_first, strip.dirty_first);
+        strip.sync_last = max(strip.sync_last, strip.dirty_last);
+        strip.dirty_first = UINT16_MAX;
+        strip.dirty_last = 0;
+        strip.pending = true;
+    }
+
+    neopixels_flush(NULL);
 }
 
 static void neopixel_out_masked (uint16_t device, rgb_color_t color, rgb_color_mask_t mask)
@@ -2537,6 +3767,9 @@ static void neopixel_out_masked (uint16_t device, rgb_color_t color, rgb_color_m
 
         rgb_1bpp_assign(&neopixel.leds[device * 3], color, mask);
 
+        strip.dirty_first = min(strip.dirty_first, device);
+        strip.dirty_last = max(strip.dirty_last, device);
+
         if(neopixel.num_leds == 1)
             neopixels_write();
     }
@@ -2554,6 +3787,12 @@ uint8_t neopixels_set_intensity (uint8_t value)
     if(neopixel.intensity != value) {
 
         neopixel.intensity = value;
+        neopixels_set_lut(value);
+
+        if(neopixel.num_leds) {
+            strip.dirty_first = 0;
+            strip.dirty_last = neopixel.num_leds - 1;
+        }
 //      neopixels_write();
     }
 
@@ -2562,6 +3801,131 @@ uint8_t neopixels_set_intensity (uint8_t value)
 
 #endif // NEOPIXELS_PIN
 
+#if USE_I2S_OUT
+
+// $I2SSTATS reports the bitstream telemetry, $I2SSTATS=R clears it.
+static status_code_t i2s_stats_command (sys_state_t state, char *args)
+{
+    i2s_out_stats_t stats;
+
+    if(args) {
+        if(!(*args == 'R' || *args == 'r'))
+            return Status_InvalidStatement;
+        i2s_out_reset_stats();
+    } else {
+        i2s_out_get_stats(&stats);
+        hal.stream.write("[I2SSTATS:");
+        hal.stream.write(uitoa(stats.buffers));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(stats.buffer_us));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(stats.underflows));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(stats.fills));
+        hal.stream.write(",");
+        hal.stream.write(ftoa((float)stats.fill_cycles_max / (float)hal.f_mcu, 1));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(stats.headroom_min));
+        hal.stream.write("]" ASCII_EOL);
+    }
+
+    return Status_OK;
+}
+
+#endif // USE_I2S_OUT
+
+/*** Driver settings ***/
+
+static nvs_address_t nvs_address;
+
+static status_code_t set_debounce (setting_id_t id, uint_fast16_t value)
+{
+    uint_fast8_t idx;
+
+    if(id == Setting_LimitDebounce)
+        driver_settings.limit_debounce = (uint16_t)value;
+    else
+        driver_settings.control_debounce = (uint16_t)value;
+
+    // Reload the windows of the configured inputs.
+    for(idx = 0; idx < sizeof(input_debounce) / sizeof(input_debounce_t); idx++) {
+        if(input_debounce[idx].input)
+            pin_debounce_config(idx, input_debounce[idx].input);
+    }
+
+    return Status_OK;
+}
+
+static uint_fast16_t get_debounce (setting_id_t id)
+{
+    return id == Setting_LimitDebounce ? driver_settings.limit_debounce : driver_settings.control_debounce;
+}
+
+static const setting_detail_t driver_settings_list[] = {
+#if USE_I2S_OUT
+    { Setting_I2SDMAProfile, Group_Stepper, "I2S DMA buffering", NULL, Format_RadioButtons, "Normal,Low latency,Deep buffer", NULL, NULL, Setting_NonCore, &driver_settings.i2s_dma_profile, NULL, NULL, { .reboot_required = On } },
+#endif
+    { Setting_LimitDebounce, Group_Limits, "Limit inputs debounce time", "microseconds", Format_Int16, "####0", NULL, "65535", Setting_NonCoreFn, set_debounce, get_debounce, NULL },
+    { Setting_ControlDebounce, Group_ControlSignals, "Control inputs debounce time", "microseconds", Format_Int16, "####0", NULL, "65535", Setting_NonCoreFn, set_debounce, get_debounce, NULL },
+#if SPINDLE_ENCODER_ENABLE
+    { Setting_SpindleRPMFilter, Group_Spindle, "Spindle encoder RPM filter", "milliseconds", Format_Int16, "###0", NULL, "5000", Setting_NonCore, &driver_settings.spindle_rpm_filter, NULL, NULL },
+#endif
+};
+
+#ifndef NO_SETTINGS_DESCRIPTIONS
+
+static const setting_descr_t driver_settings_descr[] = {
+#if USE_I2S_OUT
+    { Setting_I2SDMAProfile, "I2S step output buffering, trades feed hold response against step stream underflow resistance.\\n"
+                             "Normal: about 12 ms, Low latency: about 2 ms, Deep buffer: about 44 ms."
+    },
+#endif
+    { Setting_LimitDebounce, "Time the limit inputs must be stable after an edge before it is acted upon. Set to 0 to disable debouncing." },
+    { Setting_ControlDebounce, "Time the control and auxiliary inputs must be stable after an edge before it is acted upon. Set to 0 to disable debouncing." },
+#if SPINDLE_ENCODER_ENABLE
+    { Setting_SpindleRPMFilter, "Time constant of the low pass filter applied to the RPM reported by the spindle encoder. Set to 0 to disable filtering." },
+#endif
+};
+
+#endif
+
+static void driver_settings_save (void)
+{
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&driver_settings, sizeof(driver_settings_t), true);
+}
+
+static void driver_settings_restore (void)
+{
+#if USE_I2S_OUT
+    driver_settings.i2s_dma_profile = I2S_OUT_DMA_PROFILE;
+#endif
+    driver_settings.limit_debounce = DEBOUNCE_TIME_US;
+    driver_settings.control_debounce = DEBOUNCE_TIME_US;
+#if SPINDLE_ENCODER_ENABLE
+    driver_settings.spindle_rpm_filter = SPINDLE_RPM_FILTER_MS;
+#endif
+
+    driver_settings_save();
+}
+
+static void driver_settings_load (void)
+{
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&driver_settings, nvs_address, sizeof(driver_settings_t), true) != NVS_TransferResult_OK)
+        driver_settings_restore();
+}
+
+static setting_details_t driver_setting_details = {
+    .settings = driver_settings_list,
+    .n_settings = sizeof(driver_settings_list) / sizeof(setting_detail_t),
+#ifndef NO_SETTINGS_DESCRIPTIONS
+    .descriptions = driver_settings_descr,
+    .n_descriptions = sizeof(driver_settings_descr) / sizeof(setting_descr_t),
+#endif
+    .save = driver_settings_save,
+    .load = driver_settings_load,
+    .restore = driver_settings_restore
+};
+
 // Initializes MCU peripherals for Grbl use
 static bool driver_setup (settings_t *settings)
 {
@@ -2588,13 +3952,31 @@ static bool driver_setup (settings_t *settings)
     timer_isr_register(STEP_TIMER_GROUP, STEP_TIMER_INDEX, stepper_driver_isr, 0, ESP_INTR_FLAG_IRAM, NULL);
     timer_enable_intr(STEP_TIMER_GROUP, STEP_TIMER_INDEX);
 
+#if USE_I2S_OUT && !CONFIG_IDF_TARGET_ESP32S3
+
+    // Free running timer for passthrough mode step pulse timing, one-shot alarms are set per pulse.
+    timerConfig.counter_en = TIMER_START;
+    timerConfig.alarm_en = TIMER_ALARM_DIS;
+    timerConfig.auto_reload = false;
+
+    timer_init(STEP_TIMER_GROUP, PULSE_TIMER_INDEX, &timerConfig);
+    timer_set_counter_value(STEP_TIMER_GROUP, PULSE_TIMER_INDEX, 0ULL);
+    timer_isr_register(STEP_TIMER_GROUP, PULSE_TIMER_INDEX, i2s_pulse_timer_isr, 0, ESP_INTR_FLAG_IRAM, NULL);
+    timer_enable_intr(STEP_TIMER_GROUP, PULSE_TIMER_INDEX);
+
+#endif
+
+    out_masks_init(settings);
+
 #if USE_I2S_OUT
+    i2s_out_set_dma_profile((i2s_out_dma_profile_t)driver_settings.i2s_dma_profile);
+
     if(i2s_out_init()) {
 #if CONFIG_IDF_TARGET_ESP32S3
         i2s_set_step_outputs((axes_signals_t){ .mask = AXES_BITMASK });
         i2s_set_step_mask();
 #endif
-        i2s_out_set_pulse_callback(hal.stepper.interrupt_callback);
+        i2s_out_set_pulse_callback(I2SStepperFill);
     }
     // else report?
 #endif
@@ -2694,6 +4076,10 @@ static bool driver_setup (settings_t *settings)
 
     hal.periph_port.register_pin(&pwm);
 
+#if PPI_ENABLE
+    ppi_timer_init();
+#endif
+
     /**/
 
 #endif // DRIVER_SPINDLE_PWM_ENABLE
@@ -2733,6 +4119,10 @@ static bool driver_setup (settings_t *settings)
 
 #endif
 
+#if SPINDLE_ENCODER_ENABLE
+    spindleEncoderInit();
+#endif
+
 #if IOEXPAND_ENABLE
     ioexpand_init();
 #endif
@@ -2927,6 +4317,10 @@ bool driver_init (void)
         .esp32_off = spindleOff,
   #if PPI_ENABLE
         .pulse_on = spindlePulseOn,
+  #endif
+  #if SPINDLE_ENCODER_ENABLE
+        .get_data = spindleGetData,
+        .reset_data = spindleDataReset,
   #endif
         .cap = {
             .gpio_controlled = On,
@@ -2936,7 +4330,7 @@ bool driver_init (void)
   #if IOEXPAND_ENABLE || DRIVER_SPINDLE_DIR_ENABLE
             .direction = On,
   #endif
-  #if PWM_RAMPED
+  #if PWM_RAMPED || SPINDLE_ENCODER_ENABLE
             .at_speed = On
   #endif
 
@@ -2950,8 +4344,15 @@ bool driver_init (void)
         .set_state = spindleSetState,
         .get_state = spindleGetState,
         .esp32_off = spindleOffBasic,
+  #if SPINDLE_ENCODER_ENABLE
+        .get_data = spindleGetData,
+        .reset_data = spindleDataReset,
+  #endif
         .cap = {
             .gpio_controlled = On,
+  #if SPINDLE_ENCODER_ENABLE
+            .at_speed = On,
+  #endif
   #if IOEXPAND_ENABLE || DRIVER_SPINDLE_DIR_ENABLE
             .direction = On
   #endif
@@ -2970,6 +4371,9 @@ bool driver_init (void)
     hal.driver_cap.mist_control = On;
   #endif
     hal.driver_cap.software_debounce = On;
+#if SPINDLE_ENCODER_ENABLE
+    hal.driver_cap.spindle_encoder = On;
+#endif
     hal.driver_cap.step_pulse_delay = On;
     hal.driver_cap.amass_level = 3;
     hal.driver_cap.control_pull_up = On;
@@ -3061,13 +4465,12 @@ bool driver_init (void)
     // NS to tick converter
     float ratio = (float)counter_clk_hz / 1e9;
 
-    t0h_ticks = (uint32_t)(ratio * WS2812_T0H_NS);
-    t0l_ticks = (uint32_t)(ratio * WS2812_T0L_NS);
-    t1h_ticks = (uint32_t)(ratio * WS2812_T1H_NS);
-    t1l_ticks = (uint32_t)(ratio * WS2812_T1L_NS);
+    strip.bit[0] = (rmt_item32_t){{{ (uint32_t)(ratio * WS2812_T0H_NS), 1, (uint32_t)(ratio * WS2812_T0L_NS), 0 }}}; // Logical 0
+    strip.bit[1] = (rmt_item32_t){{{ (uint32_t)(ratio * WS2812_T1H_NS), 1, (uint32_t)(ratio * WS2812_T1L_NS), 0 }}}; // Logical 1
+    strip.reset = (rmt_item32_t){{{ (uint32_t)(ratio * WS2812_RESET_NS / 2), 0, (uint32_t)(ratio * WS2812_RESET_NS / 2), 0 }}}; // Latch, low for > 50us
 
-    // Initialize automatic timing translator
-    rmt_translator_init(neo_config.channel, ws2812_rmt_adapter);
+    neopixels_set_lut(neopixel.intensity);
+    rmt_register_tx_end_callback(neopixels_tx_end, NULL);
 
     hal.rgb0.out = neopixel_out;
     hal.rgb0.out_masked = neopixel_out_masked;
@@ -3108,6 +4511,50 @@ bool driver_init (void)
     stream_open_instance(KEYPAD_STREAM, 115200, keypad_enqueue_keycode, "Keypad");
 #endif
 
+    if((nvs_address = nvs_alloc(sizeof(driver_settings_t))))
+        settings_register(&driver_setting_details);
+
+    static const sys_command_t debounce_command_list[] = {
+        {"DEBOUNCE", debounce_command, { .allow_blocking = On }, { .str = "report debounced input pins, debounce time, edges and glitches" } }
+    };
+
+    static sys_commands_t debounce_commands = {
+        .n_commands = sizeof(debounce_command_list) / sizeof(sys_command_t),
+        .commands = debounce_command_list
+    };
+
+    system_register_commands(&debounce_commands);
+
+#if SPINDLE_ENCODER_ENABLE
+
+    static const sys_command_t spindle_encoder_command_list[] = {
+        {"SPINDLEENC", spindle_encoder_command, { .allow_blocking = On }, { .str = "report spindle encoder count, index count, last index time and period, RPM and errors" } }
+    };
+
+    static sys_commands_t spindle_encoder_commands = {
+        .n_commands = sizeof(spindle_encoder_command_list) / sizeof(sys_command_t),
+        .commands = spindle_encoder_command_list
+    };
+
+    system_register_commands(&spindle_encoder_commands);
+
+#endif
+
+#if USE_I2S_OUT
+
+    static const sys_command_t i2s_command_list[] = {
+        {"I2SSTATS", i2s_stats_command, { .allow_blocking = On }, { .str = "report I2S buffers, buffer time, underflows, fills, max fill time and min headroom, =R to reset" } }
+    };
+
+    static sys_commands_t i2s_commands = {
+        .n_commands = sizeof(i2s_command_list) / sizeof(sys_command_t),
+        .commands = i2s_command_list
+    };
+
+    system_register_commands(&i2s_commands);
+
+#endif
+
 #if WIFI_ENABLE
     wifi_init();
 #endif
@@ -3120,6 +4567,45 @@ bool driver_init (void)
     bluetooth_init_local();
 #endif
 
+#if STEP_TRACE_ENABLE
+
+    static const sys_command_t step_trace_command_list[] = {
+        {"STEPTRACE", step_trace_command, { .allow_blocking = On }, { .str = "report step output trace, =D to dump, =R to reset" } }
+    };
+
+    static sys_commands_t step_trace_commands = {
+        .n_commands = sizeof(step_trace_command_list) / sizeof(sys_command_t),
+        .commands = step_trace_command_list
+    };
+
+    system_register_commands(&step_trace_commands);
+
+#endif
+
+#if STEP_ISR_STATS_ENABLE
+
+    static const sys_command_t step_isr_command_list[] = {
+        {"STEPISR", step_isr_stats_command, { .allow_blocking = On }, { .str = "report step timer interrupt latency and execution time histograms, =R to reset" } }
+    };
+
+    static sys_commands_t step_isr_commands = {
+        .n_commands = sizeof(step_isr_command_list) / sizeof(sys_command_t),
+        .commands = step_isr_command_list
+    };
+
+    step_isr_stats_reset();
+    system_register_commands(&step_isr_commands);
+
+#endif
+
+#if HANDWHEEL_ENABLE
+    handwheel_init();
+#endif
+
+#if AXIS_ENCODERS_ENABLE
+    axis_encoders_init();
+#endif
+
 #include "grbl/plugins_init.h"
 
     // no need to move version check before init - compiler will fail any mismatch for existing entries
@@ -3135,8 +4621,7 @@ void pin_debounce (void *pin)
         debounce.safety_door = Off;
 #endif
 
-    if(input->mode.irq_mode == IRQ_Mode_Change ||
-          DIGITAL_IN(input->pin) == (input->mode.irq_mode == IRQ_Mode_Falling ? 0 : 1))
+    if(pin_is_active(input))
         switch(input->group) {
 
             case PinGroup_Limit:
@@ -3164,6 +4649,10 @@ void pin_debounce (void *pin)
 // Main stepper driver
 IRAM_ATTR static void stepper_driver_isr (void *arg)
 {
+#if STEP_ISR_STATS_ENABLE
+    // The step timer is reloaded to 0 on alarm, the counter value is the entry latency.
+    uint32_t ccount = XTHAL_GET_CCOUNT(), latency = (uint32_t)timer_group_get_counter_value_in_isr(STEP_TIMER_GROUP, STEP_TIMER_INDEX);
+#endif
 #if CONFIG_IDF_TARGET_ESP32S3
     TIMERG0.int_clr_timers.t0_int_clr = 1;
     TIMERG0.hw_timer[STEP_TIMER_INDEX].config.tn_alarm_en = TIMER_ALARM_EN;
@@ -3172,23 +4661,22 @@ IRAM_ATTR static void stepper_driver_isr (void *arg)
     TIMERG0.hw_timer[STEP_TIMER_INDEX].config.alarm_en = TIMER_ALARM_EN;
 #endif
     hal.stepper.interrupt_callback();
+#if STEP_ISR_STATS_ENABLE
+    step_isr_stats_add(latency, XTHAL_GET_CCOUNT() - ccount);
+#endif
 }
 
 #if ETHERNET_ENABLE
 
 IRAM_ATTR static void gpio_limit_isr (void *signal)
 {
-    if(((input_signal_t *)signal)->debounce)
-        task_add_delayed(pin_debounce, (input_signal_t *)signal, 40);
-    else
+    if(!(((input_signal_t *)signal)->mode.debounce && pin_debounce_start((input_signal_t *)signal)))
         hal.limits.interrupt_callback(limitsGetState());
 }
 
 IRAM_ATTR static void gpio_control_isr (void *signal)
 {
-    if(((input_signal_t *)signal)->debounce)
-        task_add_delayed(pin_debounce, (input_signal_t *)signal, 40);
-    else
+    if(!(((input_signal_t *)signal)->mode.debounce && pin_debounce_start((input_signal_t *)signal)))
         hal.control.interrupt_callback(systemGetState());
 }
 
@@ -3197,6 +4685,15 @@ IRAM_ATTR static void gpio_aux_isr (void *signal)
     ioports_event((input_signal_t *)signal);
 }
 
+#if SPINDLE_ENCODER_ENABLE && defined(SPINDLE_INDEX_PIN)
+
+IRAM_ATTR static void gpio_spindle_index_isr (void *signal)
+{
+    spindleIndexEvent();
+}
+
+#endif
+
 #if MPG_MODE == 1
 
 IRAM_ATTR static void gpio_mpg_isr (void *signal)
@@ -3225,28 +4722,33 @@ IRAM_ATTR static void gpio_i2c_strobe_isr (void *signal)
 //GPIO IRQ process
 IRAM_ATTR static void gpio_isr (void *arg)
 {
-    uint32_t grp = 0, intr_status[2];
+    uint32_t grp = 0, intr_status[2], offset, status;
+    input_signal_t *input;
 
     gpio_ll_get_intr_status(&GPIO, GRBLHAL_TASK_CORE, &intr_status[0]);         // get interrupt status for GPIO0-31
     gpio_ll_get_intr_status_high(&GPIO, GRBLHAL_TASK_CORE, &intr_status[1]);    // get interrupt status for GPIO32-39
     gpio_ll_clear_intr_status(&GPIO, intr_status[0]);                           // clear intr for gpio0-gpio31
     gpio_ll_clear_intr_status_high(&GPIO, intr_status[1]);                      // clear intr for gpio32-39
 
-    uint32_t i = sizeof(inputpin) / sizeof(input_signal_t);
-    while(i--) {
-        if(intr_status[inputpin[i].offset] & inputpin[i].mask) {
-            if(inputpin[i].mode.debounce && task_add_delayed(pin_debounce, &inputpin[i], 40)) {
-#if SAFETY_DOOR_ENABLE
-                if(inputpin[i].id == Input_SafetyDoor)
-                    debounce.safety_door = On;
-#endif
-                gpio_intr_disable(inputpin[i].pin);
-            } else if(inputpin[i].group & PinGroup_AuxInput)
-                ioports_event(&inputpin[i]);
-            else
-                grp |= inputpin[i].group;
+    for(offset = 0; offset < 2; offset++) {
+        status = intr_status[offset];
+        while(status) {
+            input = gpio_dispatch[(offset << 5) + __builtin_ctz(status)];
+            status &= status - 1;
+            for(; input; input = input->dispatch_next) {
+                if(input->mode.debounce && pin_debounce_start(input))
+                    continue;
+#if SPINDLE_ENCODER_ENABLE && defined(SPINDLE_INDEX_PIN)
+                else if(input->group == PinGroup_SpindleIndex)
+                    spindleIndexEvent();
+#endif
+                else if(input->group & PinGroup_AuxInput)
+                    ioports_event(input);
+                else
+                    grp |= input->group;
+            }
         }
-    };
+    }
 
     if(grp & (PinGroup_Limit|PinGroup_LimitMax))
         hal.limits.interrupt_callback(limitsGetState());
@@ -69,7 +69,9 @@
 #define GRBLHAL_TASK_CORE 1
 #endif
 
-#define PROBE_ISR 0 // Catch probe state change by interrupt TODO: needs verification!
+#ifndef PROBE_ISR
+#define PROBE_ISR 1 // Timestamp the interrupt latched probe edge and remove steps output after it from the probed position.
+#endif
 
 // DO NOT change settings here!
 
@@ -79,6 +81,26 @@
 
 #define IOEXPAND 0xFF   // Dummy pin number for I2C IO expander
 
+#ifndef STEP_TRACE_ENABLE
+#define STEP_TRACE_ENABLE 0 // Step output event log.
+#endif
+
+#ifndef STEP_ISR_STATS_ENABLE
+#define STEP_ISR_STATS_ENABLE 0 // Step timer interrupt latency and execution time histograms.
+#endif
+
+#ifndef DEBOUNCE_TIME_US
+#define DEBOUNCE_TIME_US 40000 // Default limit and control input debounce time, may be changed at run time via $-settings.
+#endif
+
+#ifndef SPINDLE_RPM_FILTER_MS
+#define SPINDLE_RPM_FILTER_MS 100 // Default spindle encoder RPM filter time constant, may be changed at run time via $-settings.
+#endif
+
+#ifndef SPINDLE_PWM_LUT_SIZE
+#define SPINDLE_PWM_LUT_SIZE 128 // Number of intervals in the RPM to PWM lookup table, 0 to disable.
+#endif
+
 static const DRAM_ATTR float FZERO = 0.0f;
 
 // end configuration
@@ -171,6 +193,32 @@ typedef struct {
 #define DRIVER_SPINDLE_PWM_ENABLE 0
 #endif
 
+#if SPINDLE_ENCODER_ENABLE && !(DRIVER_SPINDLE_ENABLE && defined(SPINDLE_PULSE_PIN))
+#warning "Spindle encoder is not supported by board map!"
+#undef SPINDLE_ENCODER_ENABLE
+#define SPINDLE_ENCODER_ENABLE 0
+#endif
+
+#if SPINDLE_SYNC_ENABLE
+#warning "Spindle synchronized motion is not supported by the driver!"
+#undef SPINDLE_SYNC_ENABLE
+#define SPINDLE_SYNC_ENABLE 0
+#endif
+
+#ifndef HANDWHEEL_ENABLE
+#define HANDWHEEL_ENABLE 0
+#endif
+
+#ifndef AXIS_ENCODERS_ENABLE
+#define AXIS_ENCODERS_ENABLE 0
+#endif
+
+#if HANDWHEEL_ENABLE && !(defined(HANDWHEEL_A_PIN) && defined(HANDWHEEL_B_PIN))
+#warning "MPG handwheel input is not supported by board map!"
+#undef HANDWHEEL_ENABLE
+#define HANDWHEEL_ENABLE 0
+#endif
+
 #if SAFETY_DOOR_ENABLE && !defined(SAFETY_DOOR_PIN)
 #warning "Safety door input is not available!"
 #undef SAFETY_DOOR_ENABLE
@@ -299,6 +347,19 @@ extern SemaphoreHandle_t i2cBusy;
 #define DIGITAL_OUT(pin, state) gpio_ll_set_level(&GPIO, pin, state)
 #endif
 
+// Driver setting ids, allocated from the range reserved for drivers as the user defined
+// settings ($450 - $459) are left to user plugins.
+#define Setting_I2SDMAProfile           (setting_id_t)(Setting_DriverStart + 0)
+#define Setting_LimitDebounce           (setting_id_t)(Setting_DriverStart + 1)
+#define Setting_ControlDebounce         (setting_id_t)(Setting_DriverStart + 2)
+#define Setting_SpindleRPMFilter        (setting_id_t)(Setting_DriverStart + 3)
+#define Setting_FollowingErrorLimit     (setting_id_t)(Setting_DriverStart + 4)
+#define Setting_FollowingErrorAction    (setting_id_t)(Setting_DriverStart + 5)
+
+#if PPI_ENABLE && (!DRIVER_SPINDLE_PWM_ENABLE || IOEXPAND_ENABLE || !defined(SPINDLE_ENABLE_PIN))
+#error "Laser PPI requires the PWM spindle and a spindle enable signal on a GPIO pin!"
+#endif
+
 typedef enum
 {
     Pin_GPIO = 0,
@@ -312,7 +373,7 @@ typedef struct {
     gpio_num_t pin;
 } adc_map_t;
 
-typedef struct {
+typedef struct input_signal {
     uint8_t pin;
     uint8_t user_port;
     uint8_t offset;
@@ -325,6 +386,7 @@ typedef struct {
     const adc_map_t *adc;
     ioport_interrupt_callback_ptr interrupt_callback;
     const char *description;
+    struct input_signal *dispatch_next; // next input sharing the GPIO
 } input_signal_t;
 
 typedef struct {
@@ -0,0 +1,164 @@
+/*
+
+  handwheel.c - driver code for ESP32
+
+  Quadrature MPG handwheel input
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if HANDWHEEL_ENABLE
+
+#include <math.h>
+#include <string.h>
+
+#include "esp_timer.h"
+
+#include "handwheel.h"
+#include "pcnt_encoder.h"
+
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+#include "grbl/nuts_bolts.h"
+
+#ifndef HANDWHEEL_FILTER
+#define HANDWHEEL_FILTER 1000 // APB clock cycles, 12.5 us
+#endif
+
+#define HANDWHEEL_DEFAULT_SCALE 1 // used when no step size selector inputs are available
+
+// The handwheel is counted in hardware, edges are not lost when the foreground is busy.
+// Detents counted are converted to relative jog moves at a fixed rate, the feed rate is set
+// so that the move completes within the interval. Counts are only consumed when the jog
+// command is accepted, movement while running a program is discarded.
+
+typedef struct {
+    pcnt_encoder_t counter;
+    int32_t last_count;
+    int64_t next_poll;
+    uint8_t n_axis_ports;
+    uint8_t axis_port[2];
+    uint8_t n_scale_ports;
+    uint8_t scale_port[2];
+} handwheel_t;
+
+static const float scale[] = { 0.001f, 0.01f, 0.1f, 1.0f }; // mm per detent
+
+static handwheel_t handwheel = {0};
+static on_execute_realtime_ptr on_execute_realtime;
+
+// Binary coded selector, first port is the least significant bit.
+static uint_fast8_t read_selector (uint8_t *port, uint_fast8_t n_ports)
+{
+    uint_fast8_t value = 0;
+
+    while(n_ports--)
+        value = (value << 1) | (hal.port.wait_on_input(Port_Digital, port[n_ports], WaitMode_Immediate, 0.0f) == 1);
+
+    return value;
+}
+
+static void handwheel_poll (sys_state_t state)
+{
+    int64_t now = esp_timer_get_time();
+
+    on_execute_realtime(state);
+
+    if(now < handwheel.next_poll)
+        return;
+
+    handwheel.next_poll = now + HANDWHEEL_INTERVAL_MS * 1000;
+
+    int32_t detents = (pcnt_encoder_get_count(&handwheel.counter) - handwheel.last_count) / HANDWHEEL_COUNTS_PER_DETENT;
+
+    if(detents == 0)
+        return;
+
+    uint_fast8_t axis = read_selector(handwheel.axis_port, handwheel.n_axis_ports);
+
+    if(!(state == STATE_IDLE || state == STATE_JOG) || axis >= N_AXIS) {
+        handwheel.last_count += detents * HANDWHEEL_COUNTS_PER_DETENT;
+        return;
+    }
+
+    char command[50];
+    float distance = (float)detents * scale[handwheel.n_scale_ports ? read_selector(handwheel.scale_port, handwheel.n_scale_ports) : HANDWHEEL_DEFAULT_SCALE],
+          feed_rate = min(fabsf(distance) * 60000.0f / (float)HANDWHEEL_INTERVAL_MS, settings.axis[axis].max_rate);
+
+    strcpy(command, "$J=G91G21");
+    strcat(command, axis_letter[axis]);
+    strcat(command, ftoa(distance, 3));
+    strcat(command, "F");
+    strcat(command, ftoa(feed_rate, 0));
+
+    if(grbl.enqueue_gcode(command))
+        handwheel.last_count += detents * HANDWHEEL_COUNTS_PER_DETENT;
+}
+
+void handwheel_init (void)
+{
+    static const char *axis_descr[] = { "MPG axis select 0", "MPG axis select 1" };
+    static const char *scale_descr[] = { "MPG step size select 0", "MPG step size select 1" };
+
+    static const periph_pin_t phase_a = {
+        .function = Input_QEI_A,
+        .group = PinGroup_QEI,
+        .pin = HANDWHEEL_A_PIN,
+        .mode = { .mask = PINMODE_NONE },
+        .description = "MPG"
+    };
+
+    static const periph_pin_t phase_b = {
+        .function = Input_QEI_B,
+        .group = PinGroup_QEI,
+        .pin = HANDWHEEL_B_PIN,
+        .mode = { .mask = PINMODE_NONE },
+        .description = "MPG"
+    };
+
+    uint_fast8_t idx;
+    uint8_t n_ports = ioports_available(Port_Digital, Port_Input);
+
+    if(!pcnt_encoder_init(&handwheel.counter, HANDWHEEL_PCNT_UNIT, HANDWHEEL_A_PIN, HANDWHEEL_B_PIN, HANDWHEEL_FILTER))
+        return;
+
+    hal.periph_port.register_pin(&phase_a);
+    hal.periph_port.register_pin(&phase_b);
+
+    for(idx = 0; idx < min(HANDWHEEL_AXIS_INPUTS, 2) && n_ports; idx++) {
+        handwheel.axis_port[idx] = --n_ports;
+        if(!ioport_claim(Port_Digital, Port_Input, &handwheel.axis_port[idx], axis_descr[idx]))
+            break;
+        handwheel.n_axis_ports++;
+    }
+
+    for(idx = 0; idx < min(HANDWHEEL_SCALE_INPUTS, 2) && n_ports; idx++) {
+        handwheel.scale_port[idx] = --n_ports;
+        if(!ioport_claim(Port_Digital, Port_Input, &handwheel.scale_port[idx], scale_descr[idx]))
+            break;
+        handwheel.n_scale_ports++;
+    }
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = handwheel_poll;
+}
+
+#endif // HANDWHEEL_ENABLE
@@ -0,0 +1,53 @@
+/*
+
+  handwheel.h - driver code for ESP32
+
+  Quadrature MPG handwheel input
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _HANDWHEEL_H_
+#define _HANDWHEEL_H_
+
+#include "driver.h"
+
+#ifndef HANDWHEEL_PCNT_UNIT
+#define HANDWHEEL_PCNT_UNIT PCNT_UNIT_1
+#endif
+
+#ifndef HANDWHEEL_COUNTS_PER_DETENT
+#define HANDWHEEL_COUNTS_PER_DETENT 4   // quadrature edges per detent, 4 for the common 100 PPR handwheels
+#endif
+
+#ifndef HANDWHEEL_INTERVAL_MS
+#define HANDWHEEL_INTERVAL_MS 50        // jog command rate
+#endif
+
+#ifndef HANDWHEEL_AXIS_INPUTS
+#define HANDWHEEL_AXIS_INPUTS 2         // number of aux inputs claimed for the binary coded axis selector, 0 - 2
+#endif
+
+#ifndef HANDWHEEL_SCALE_INPUTS
+#define HANDWHEEL_SCALE_INPUTS 2        // number of aux inputs claimed for the binary coded step size selector, 0 - 2
+#endif
+
+void handwheel_init (void);
+
+#endif
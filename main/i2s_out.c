@@ -52,7 +52,9 @@
 #include <rom/lldesc.h>
 #include <soc/i2s_struct.h>
 #include <freertos/queue.h>
+#include <xtensa/core-macros.h>
 
+#include <string.h>
 #include <stdatomic.h>
 
 #include "i2s_out.h"
@@ -72,12 +74,19 @@
 // but on the other hand, it leads to a delay with pulse and/or non-pulse-generated I/Os.
 // The number of I2S_OUT_DMABUF_COUNT should be chosen carefully.
 //
+// The buffer count and size are selected at run time by i2s_out_set_dma_profile(),
+// I2S_OUT_DMABUF_COUNT and I2S_OUT_DMABUF_LEN are the normal profile.
+//
 // Reference information:
 //   FreeRTOS task time slice = portTICK_PERIOD_MS = 1 ms (ESP32 FreeRTOS port)
 //
 #define I2S_SAMPLE_SIZE 4                                       /* 4 bytes, 32 bits per sample */
-#define DMA_SAMPLE_COUNT (I2S_OUT_DMABUF_LEN / I2S_SAMPLE_SIZE) /* number of samples per buffer */
+#define DMA_SAMPLE_COUNT (dma_cfg.len / I2S_SAMPLE_SIZE)        /* number of samples per buffer */
+#if (20 / I2S_OUT_USEC_PER_PULSE) > (I2S_OUT_DELAY_SAMPLES_MAX + I2S_OUT_PULSE_SAMPLES_MAX)
 #define SAMPLE_SAFE_COUNT (20 / I2S_OUT_USEC_PER_PULSE)         /* prevent buffer overrun (GRBL's $0 should be less than or equal 20) */
+#else
+#define SAMPLE_SAFE_COUNT (I2S_OUT_DELAY_SAMPLES_MAX + I2S_OUT_PULSE_SAMPLES_MAX) /* prevent buffer overrun, a step record must fit */
+#endif
 
 typedef struct {
     uint32_t**   buffers;
@@ -88,6 +97,47 @@ typedef struct {
 } i2s_out_dma_t;
 
 static i2s_out_dma_t o_dma;
+
+typedef struct {
+    uint32_t port_data;     // pin state when queued
+    uint32_t step_set;      // step bits to set during the pulse
+    uint32_t step_clear;    // step bits to clear during the pulse
+    uint16_t delay;         // direction setup samples
+    uint16_t pulse;         // pulse samples, 0 for a step period without steps
+    uint32_t idle;          // time remaining of the step period after the pulse (usec)
+} i2s_out_segment_t;
+
+// Step segment records, queued by the pulse callback and expanded by the DMA buffer filler.
+// Both run in the bitstream task, the tail is only changed with the pulser lock held.
+typedef struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    int32_t budget;         // samples left in the buffer being filled not yet claimed by queued records
+    uint32_t idle_data;     // pin state for the idle run following the last expanded record
+    i2s_out_segment_t seg[I2S_OUT_SEGMENT_QUEUE_SIZE];
+} i2s_out_segment_queue_t;
+
+static i2s_out_segment_queue_t seg_q;
+
+#if I2S_OUT_SEGMENT_QUEUE_SIZE & (I2S_OUT_SEGMENT_QUEUE_SIZE - 1)
+#error "I2S_OUT_SEGMENT_QUEUE_SIZE must be a power of 2"
+#endif
+typedef struct {
+    uint32_t count;     // number of DMA buffers
+    uint32_t len;       // size of each DMA buffer in bytes (4092 is DMA's limit)
+    uint32_t buf_ms;    // time to transfer one buffer
+    uint32_t delay_ms;  // time to transfer all the buffers
+} i2s_out_dma_cfg_t;
+
+static const i2s_out_dma_cfg_t dma_profiles[] = {
+    [I2SDMA_Normal]     = { I2S_OUT_DMABUF_COUNT, I2S_OUT_DMABUF_LEN },
+    [I2SDMA_LowLatency] = { I2S_OUT_DMABUF_COUNT_LOW_LATENCY, I2S_OUT_DMABUF_LEN_LOW_LATENCY },
+    [I2SDMA_DeepBuffer] = { I2S_OUT_DMABUF_COUNT_DEEP, I2S_OUT_DMABUF_LEN_DEEP }
+};
+
+static i2s_out_dma_cfg_t dma_cfg = { I2S_OUT_DMABUF_COUNT, I2S_OUT_DMABUF_LEN, I2S_OUT_DELAY_DMABUF_MS, I2S_OUT_DELAY_MS };
+static i2s_out_stats_t stats = { .headroom_min = I2S_OUT_DMABUF_COUNT };
+
 static intr_handle_t i2s_out_isr_handle;
 
 // output value
@@ -193,21 +243,21 @@ static void IRAM_ATTR i2s_clear_dma_buffer (lldesc_t *dma_desc, uint32_t port_da
     }
     // Restore the buffer length.
     // The length may have been changed short when the data was filled in to prevent buffer overrun.
-    dma_desc->length = I2S_OUT_DMABUF_LEN;
+    dma_desc->length = dma_cfg.len;
 }
 
 static void IRAM_ATTR i2s_clear_o_dma_buffers (uint32_t port_data)
 {
-    for (int buf_idx = 0; buf_idx < I2S_OUT_DMABUF_COUNT; buf_idx++) {
+    for (int buf_idx = 0; buf_idx < dma_cfg.count; buf_idx++) {
         // Initialize DMA descriptor
         o_dma.desc[buf_idx]->owner        = 1;
         o_dma.desc[buf_idx]->eof          = 1;  // set to 1 will trigger the interrupt
         o_dma.desc[buf_idx]->sosf         = 0;
-        o_dma.desc[buf_idx]->length       = I2S_OUT_DMABUF_LEN;
-        o_dma.desc[buf_idx]->size         = I2S_OUT_DMABUF_LEN;
+        o_dma.desc[buf_idx]->length       = dma_cfg.len;
+        o_dma.desc[buf_idx]->size         = dma_cfg.len;
         o_dma.desc[buf_idx]->buf          = (uint8_t*)o_dma.buffers[buf_idx];
         o_dma.desc[buf_idx]->offset       = 0;
-        o_dma.desc[buf_idx]->qe.stqe_next = (lldesc_t*)((buf_idx < (I2S_OUT_DMABUF_COUNT - 1)) ? (o_dma.desc[buf_idx + 1]) : o_dma.desc[0]);
+        o_dma.desc[buf_idx]->qe.stqe_next = (lldesc_t*)((buf_idx < (dma_cfg.count - 1)) ? (o_dma.desc[buf_idx + 1]) : o_dma.desc[0]);
         i2s_clear_dma_buffer(o_dma.desc[buf_idx], port_data);
     }
 }
@@ -331,78 +381,110 @@ static bool IRAM_ATTR i2s_out_start (void)
     return true;
 }
 
+// Block fill of a run of identical samples
+static inline void IRAM_ATTR i2s_fill_samples (uint32_t *buf, uint32_t port_data, uint32_t n)
+{
+    while (n >= 4) {
+        buf[0] = port_data;
+        buf[1] = port_data;
+        buf[2] = port_data;
+        buf[3] = port_data;
+        buf += 4;
+        n -= 4;
+    }
+    while (n--) {
+        *buf++ = port_data;
+    }
+}
+
+// Time remaining of a step period after the direction setup and pulse samples
+static inline uint32_t IRAM_ATTR i2s_segment_idle (uint32_t period, uint32_t samples)
+{
+    return period >= I2S_OUT_USEC_PER_PULSE * samples ? period - I2S_OUT_USEC_PER_PULSE * samples : I2S_OUT_USEC_PER_PULSE; // too fast!
+}
+
+// Called with the pulser lock held, the lock is released while the pulse callback runs
+// as the callback may change the pulser status.
 static void IRAM_ATTR i2s_fillout_dma_buffer (lldesc_t *dma_desc)
 {
-    uint32_t *buf = (uint32_t *)dma_desc->buf;
-    o_dma.rw_pos  = 0;
+    uint32_t *buf = (uint32_t *)dma_desc->buf, n, old_rw_pos;
     // It reuses the oldest (just transferred) buffer with the name "current"
     // and fills the buffer for later DMA.
-    I2S_OUT_PULSER_ENTER_CRITICAL();  // Lock pulser status
-    if (i2s_out_pulser_status == STEPPING) {
-        //
-        // Fillout the buffer for pulse
-        //
-        // To avoid buffer overflow, all of the maximum pulse width (normally about 10us)
-        // is adjusted to be in a single buffer.
-        // DMA_SAMPLE_SAFE_COUNT is referred to as the margin value.
-        // Therefore, if a buffer is close to full and it is time to generate a pulse,
-        // the generation of the buffer is interrupted (the buffer length is shortened slightly)
-        // and the pulse generation is postponed until the next buffer is filled.
-        //
-        o_dma.rw_pos = 0;
-        while (o_dma.rw_pos < (DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT)) {
-            // no data to read (buffer empty)
-            if (i2s_out_remain_time_until_next_pulse < I2S_OUT_USEC_PER_PULSE) {
-                // pulser status may change in pulse phase func, so I need to check it every time.
-                if (i2s_out_pulser_status == STEPPING) {
-                    // fillout future DMA buffer (tail of the DMA buffer chains)
-                    if (i2s_out_pulse_func != NULL) {
-                        uint32_t old_rw_pos = o_dma.rw_pos;
-                        I2S_OUT_PULSER_EXIT_CRITICAL();   // Temporarily unlocked status lock as it may be locked in pulse callback.
-                        i2s_out_pulse_func();             // should be pushed into buffer max DMA_SAMPLE_SAFE_COUNT
-                        I2S_OUT_PULSER_ENTER_CRITICAL();  // Lock again.
-                        // Calculate pulse period.
-                        i2s_out_remain_time_until_next_pulse += i2s_out_pulse_period - I2S_OUT_USEC_PER_PULSE * (o_dma.rw_pos - old_rw_pos);
-                        if (i2s_out_pulser_status == WAITING) {
-                            // i2s_out_set_passthrough() has called from the pulse function.
-                            // It needs to go into pass-through mode.
-                            // This DMA descriptor must be a tail of the chain.
-                            dma_desc->qe.stqe_next = NULL;  // Cut the DMA descriptor ring. This allow us to identify the tail of the buffer.
-                        } else if (i2s_out_pulser_status == PASSTHROUGH) {
-                            // i2s_out_reset() has called during the execution of the pulse function.
-                            // I2S has already in static mode, and buffers has cleared to zero.
-                            // To prevent the pulse function from being called back,
-                            // we assume that the buffer is already full.
-                            i2s_out_remain_time_until_next_pulse = 0;                 // There is no need to fill the current buffer.
-                            o_dma.rw_pos                         = DMA_SAMPLE_COUNT;  // The buffer is full.
-                            break;
-                        }
-                        continue;
-                    }
+    //
+    // Fillout the buffer for pulse
+    //
+    // To avoid buffer overflow, all of the maximum pulse width (normally about 10us)
+    // is adjusted to be in a single buffer.
+    // DMA_SAMPLE_SAFE_COUNT is referred to as the margin value.
+    // Therefore, if a buffer is close to full and it is time to generate a pulse,
+    // the generation of the buffer is interrupted (the buffer length is shortened slightly)
+    // and the pulse generation is postponed until the next buffer is filled.
+    //
+    // The pulse callback queues step segment records, each a short direction setup and pulse
+    // pattern followed by an idle run up to the next step period. The filler expands the records
+    // with block fills and only calls back when the queue is empty.
+    //
+    o_dma.rw_pos = 0;
+    while (o_dma.rw_pos < (DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT)) {
+        if (i2s_out_remain_time_until_next_pulse < I2S_OUT_USEC_PER_PULSE) {
+            if (seg_q.tail != seg_q.head) {
+                // expand the next step segment record
+                i2s_out_segment_t *seg = &seg_q.seg[seg_q.tail & (I2S_OUT_SEGMENT_QUEUE_SIZE - 1)];
+                i2s_fill_samples(&buf[o_dma.rw_pos], seg->port_data, seg->delay);
+                i2s_fill_samples(&buf[o_dma.rw_pos + seg->delay], (seg->port_data & ~seg->step_clear) | seg->step_set, seg->pulse);
+                o_dma.rw_pos += seg->delay + seg->pulse;
+                i2s_out_remain_time_until_next_pulse += seg->idle;
+                seg_q.idle_data = seg->port_data;
+                seg_q.tail++;
+                continue;
+            }
+            // pulser status may change in pulse phase func, so I need to check it every time.
+            if (i2s_out_pulser_status == STEPPING && i2s_out_pulse_func != NULL) {
+                // fillout future DMA buffer (tail of the DMA buffer chains)
+                old_rw_pos = o_dma.rw_pos;
+                seg_q.budget = DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT - o_dma.rw_pos;
+                I2S_OUT_PULSER_EXIT_CRITICAL();   // Temporarily unlocked status lock as it may be locked in pulse callback.
+                i2s_out_pulse_func();             // should queue step segment records or push max DMA_SAMPLE_SAFE_COUNT samples
+                I2S_OUT_PULSER_ENTER_CRITICAL();  // Lock again.
+                if (seg_q.tail == seg_q.head) {
+                    // Calculate pulse period for samples pushed directly.
+                    i2s_out_remain_time_until_next_pulse += i2s_segment_idle(i2s_out_pulse_period, o_dma.rw_pos - old_rw_pos);
                 }
+                if (i2s_out_pulser_status == WAITING) {
+                    // i2s_out_set_passthrough() has called from the pulse function.
+                    // It needs to go into pass-through mode, the records queued before are expanded first.
+                    // This DMA descriptor must be a tail of the chain.
+                    dma_desc->qe.stqe_next = NULL;  // Cut the DMA descriptor ring. This allow us to identify the tail of the buffer.
+                } else if (i2s_out_pulser_status == PASSTHROUGH) {
+                    // i2s_out_reset() has called during the execution of the pulse function.
+                    // I2S has already in static mode, and buffers has cleared to zero.
+                    // To prevent the pulse function from being called back,
+                    // we assume that the buffer is already full.
+                    seg_q.tail                           = seg_q.head;        // Drop the queued records.
+                    i2s_out_remain_time_until_next_pulse = 0;                 // There is no need to fill the current buffer.
+                    o_dma.rw_pos                         = DMA_SAMPLE_COUNT;  // The buffer is full.
+                    break;
+                }
+                continue;
             }
-            // no pulse data in push buffer (pulse off or idle or callback is not defined)
-            buf[o_dma.rw_pos++] = atomic_load(&i2s_out_port_data);
-            if (i2s_out_remain_time_until_next_pulse >= I2S_OUT_USEC_PER_PULSE) {
-                i2s_out_remain_time_until_next_pulse -= I2S_OUT_USEC_PER_PULSE;
-            } else {
-                i2s_out_remain_time_until_next_pulse = 0;
+            // no more pulse data (pulse off or callback is not defined), pad the rest of the buffer
+            n = DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT - o_dma.rw_pos;
+            i2s_out_remain_time_until_next_pulse = 0;
+        } else {
+            // idle run up to the next pulse or the end of the buffer
+            n = i2s_out_remain_time_until_next_pulse / I2S_OUT_USEC_PER_PULSE;
+            if (n > DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT - o_dma.rw_pos) {
+                n = DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT - o_dma.rw_pos;
             }
+            i2s_out_remain_time_until_next_pulse -= n * I2S_OUT_USEC_PER_PULSE;
         }
-        // set filled length to the DMA descriptor
-        dma_desc->length = o_dma.rw_pos * I2S_SAMPLE_SIZE;
-    } else if (i2s_out_pulser_status == WAITING) {
-        i2s_clear_dma_buffer(dma_desc, 0);  // Essentially, no clearing is required. I'll make sure I know when I've written something.
-        o_dma.rw_pos           = 0;         // If someone calls i2s_out_push_sample, make sure there is no buffer overflow
-        dma_desc->qe.stqe_next = NULL;      // Cut the DMA descriptor ring. This allow us to identify the tail of the buffer.
-    } else {
-        // Stepper paused (passthrough state, static I2S control mode)
-        // In the passthrough mode, there is no need to fill the buffer with port_data.
-        i2s_clear_dma_buffer(dma_desc, 0);  // Essentially, no clearing is required. I'll make sure I know when I've written something.
-        o_dma.rw_pos                         = 0;  // If someone calls i2s_out_push_sample, make sure there is no buffer overflow
-        i2s_out_remain_time_until_next_pulse = 0;
+        // Direction changes for records still queued are already applied to the pin state,
+        // the idle run between records keeps the state of the record it follows.
+        i2s_fill_samples(&buf[o_dma.rw_pos], seg_q.tail != seg_q.head ? seg_q.idle_data : atomic_load(&i2s_out_port_data), n);
+        o_dma.rw_pos += n;
     }
-    I2S_OUT_PULSER_EXIT_CRITICAL();  // Unlock pulser status
+    // set filled length to the DMA descriptor
+    dma_desc->length = o_dma.rw_pos * I2S_SAMPLE_SIZE;
 }
 
 //
@@ -438,16 +520,24 @@ static void IRAM_ATTR i2s_out_intr_handler (void *arg)
             uint32_t port_data = 0;
             if (i2s_out_pulser_status == STEPPING) {
                 port_data = atomic_load(&i2s_out_port_data);
+                stats.underflows++;
             }
             I2S_OUT_PULSER_EXIT_CRITICAL_ISR();
             for (int i = 0; i < DMA_SAMPLE_COUNT; i++) {
                 ((uint32_t *)front_desc->buf)[i] = port_data;
             }
-            front_desc->length = I2S_OUT_DMABUF_LEN;
+            front_desc->length = dma_cfg.len;
         }
 
         // Send a DMA complete event to the I2S bitstreamer task with finished buffer
         xQueueSendFromISR(o_dma.queue, &finish_desc, &high_priority_task_awoken);
+
+        if (i2s_out_pulser_status == STEPPING) {
+            uint32_t headroom = dma_cfg.count - uxQueueMessagesWaitingFromISR(o_dma.queue);
+            if (headroom < stats.headroom_min) {
+                stats.headroom_min = headroom;
+            }
+        }
     }
 
     if (high_priority_task_awoken == pdTRUE)
@@ -460,6 +550,46 @@ static void IRAM_ATTR i2s_out_intr_handler (void *arg)
 //
 // I2S bitstream generator task
 //
+static inline void IRAM_ATTR i2s_out_fill (lldesc_t *dma_desc)
+{
+    o_dma.current = (uint32_t*)(dma_desc->buf);
+    // It reuses the oldest (just transferred) buffer with the name "current"
+    // and fills the buffer for later DMA.
+    I2S_OUT_PULSER_ENTER_CRITICAL();  // Lock pulser status
+    if (i2s_out_pulser_status == STEPPING) {
+        uint32_t cycles = XTHAL_GET_CCOUNT();
+        i2s_fillout_dma_buffer(dma_desc);
+        cycles = XTHAL_GET_CCOUNT() - cycles;
+        stats.fills++;
+        if (cycles > stats.fill_cycles_max) {
+            stats.fill_cycles_max = cycles;
+        }
+    } else if (i2s_out_pulser_status == WAITING) {
+        if (dma_desc->qe.stqe_next == NULL) {
+            // Tail of the DMA descriptor found
+            // I2S TX module has already stopped by ISR
+            i2s_out_stop();
+            i2s_clear_o_dma_buffers(0);  // 0 for static I2S control mode (right ch. data is always 0)
+            // You need to set the status before calling i2s_out_start()
+            // because the process in i2s_out_start() is different depending on the status.
+            i2s_out_pulser_status = PASSTHROUGH;
+            i2s_out_start();
+        } else {
+            // Processing a buffer slightly ahead of the tail buffer.
+            // We don't need to fill up the buffer by port_data any more.
+            i2s_clear_dma_buffer(dma_desc, 0);  // Essentially, no clearing is required. I'll make sure I know when I've written something.
+            o_dma.rw_pos           = 0;         // If someone calls i2s_out_push_sample, make sure there is no buffer overflow
+            dma_desc->qe.stqe_next = NULL;      // Cut the DMA descriptor ring. This allow us to identify the tail of the buffer.
+        }
+    } else {
+        // Stepper paused (passthrough state, static I2S control mode)
+        // In the passthrough mode, there is no need to fill the buffer with port_data.
+        i2s_clear_dma_buffer(dma_desc, 0);  // Essentially, no clearing is required. I'll make sure I know when I've written something.
+        o_dma.rw_pos = 0;                   // If someone calls i2s_out_push_sample, make sure there is no buffer overflow
+    }
+    I2S_OUT_PULSER_EXIT_CRITICAL();  // Unlock pulser status
+}
+
 static void IRAM_ATTR i2sOutTask (void* parameter)
 {
     lldesc_t *dma_desc;
@@ -468,47 +598,7 @@ static void IRAM_ATTR i2sOutTask (void* parameter)
         // Wait a DMA complete event from I2S isr
         // (Block until a DMA transfer has complete)
         xQueueReceive(o_dma.queue, &dma_desc, portMAX_DELAY);
-        o_dma.current = (uint32_t*)(dma_desc->buf);
-        // It reuses the oldest (just transferred) buffer with the name "current"
-        // and fills the buffer for later DMA.
-        I2S_OUT_PULSER_ENTER_CRITICAL();  // Lock pulser status
-        if (i2s_out_pulser_status == STEPPING) {
-            //
-            // Fillout the buffer for pulse
-            //
-            // To avoid buffer overflow, all of the maximum pulse width (normaly about 10us)
-            // is adjusted to be in a single buffer.
-            // DMA_SAMPLE_SAFE_COUNT is referred to as the margin value.
-            // Therefore, if a buffer is close to full and it is time to generate a pulse,
-            // the generation of the buffer is interrupted (the buffer length is shortened slightly)
-            // and the pulse generation is postponed until the next buffer is filled.
-            //
-            i2s_fillout_dma_buffer(dma_desc);
-            dma_desc->length = o_dma.rw_pos * I2S_SAMPLE_SIZE;
-        } else if (i2s_out_pulser_status == WAITING) {
-            if (dma_desc->qe.stqe_next == NULL) {
-                // Tail of the DMA descriptor found
-                // I2S TX module has already stopped by ISR
-                i2s_out_stop();
-                i2s_clear_o_dma_buffers(0);  // 0 for static I2S control mode (right ch. data is always 0)
-                // You need to set the status before calling i2s_out_start()
-                // because the process in i2s_out_start() is different depending on the status.
-                i2s_out_pulser_status = PASSTHROUGH;
-                i2s_out_start();
-            } else {
-                // Processing a buffer slightly ahead of the tail buffer.
-                // We don't need to fill up the buffer by port_data any more.
-                i2s_clear_dma_buffer(dma_desc, 0);  // Essentially, no clearing is required. I'll make sure I know when I've written something.
-                o_dma.rw_pos           = 0;         // If someone calls i2s_out_push_sample, make sure there is no buffer overflow
-                dma_desc->qe.stqe_next = NULL;      // Cut the DMA descriptor ring. This allow us to identify the tail of the buffer.
-            }
-        } else {
-            // Stepper paused (passthrough state, static I2S control mode)
-            // In the passthrough mode, there is no need to fill the buffer with port_data.
-            i2s_clear_dma_buffer(dma_desc, 0);  // Essentially, no clearing is required. I'll make sure I know when I've written something.
-            o_dma.rw_pos = 0;                   // If someone calls i2s_out_push_sample, make sure there is no buffer overflow
-        }
-        I2S_OUT_PULSER_EXIT_CRITICAL();  // Unlock pulser status
+        i2s_out_fill(dma_desc);
     }
 }
 
@@ -525,7 +615,7 @@ void IRAM_ATTR i2s_out_delay (void)
     } else {
         // Just wait until the data now registered in the DMA descripter
         // is reflected in the I2S TX module via FIFO.
-        delay(I2S_OUT_DELAY_MS);
+        delay(dma_cfg.delay_ms);
     }
     I2S_OUT_PULSER_EXIT_CRITICAL();
 }
@@ -545,6 +635,17 @@ void IRAM_ATTR i2s_out_write (uint8_t pin, uint8_t val)
     }
 }
 
+void IRAM_ATTR i2s_out_write_masked (uint32_t set, uint32_t clear)
+{
+    uint32_t port_data = atomic_load(&i2s_out_port_data);
+
+    while (!atomic_compare_exchange_weak(&i2s_out_port_data, &port_data, (port_data & ~clear) | set));
+
+    if (i2s_out_pulser_status == PASSTHROUGH) {
+        i2s_out_single_data();
+    }
+}
+
 bool IRAM_ATTR i2s_out_state (uint8_t pin)
 {
     uint32_t port_data = atomic_load(&i2s_out_port_data);
@@ -552,6 +653,11 @@ bool IRAM_ATTR i2s_out_state (uint8_t pin)
     return (!!(port_data & bit(pin)));
 }
 
+uint32_t IRAM_ATTR i2s_out_get_state (void)
+{
+    return atomic_load(&i2s_out_port_data);
+}
+
 uint32_t IRAM_ATTR i2s_out_push_sample (uint32_t num)
 {
     if (num > SAMPLE_SAFE_COUNT) {
@@ -568,6 +674,72 @@ uint32_t IRAM_ATTR i2s_out_push_sample (uint32_t num)
     return n;
 }
 
+uint32_t IRAM_ATTR i2s_out_push_pulse (uint32_t step_set, uint32_t step_clear, uint32_t delay, uint32_t pulse)
+{
+    if (delay + pulse > SAMPLE_SAFE_COUNT || pulse == 0) {
+        return 0;
+    }
+
+    uint32_t port_data = atomic_load(&i2s_out_port_data);
+    uint32_t *buf = &o_dma.current[o_dma.rw_pos];
+
+    i2s_fill_samples(buf, port_data, delay);
+    i2s_fill_samples(buf + delay, (port_data & ~step_clear) | step_set, pulse);
+    o_dma.rw_pos += delay + pulse;
+
+    return delay + pulse;
+}
+
+bool IRAM_ATTR i2s_out_push_segment (uint32_t step_set, uint32_t step_clear, uint32_t delay, uint32_t pulse)
+{
+    uint32_t head = seg_q.head;
+
+    if (pulse == 0) {
+        delay = 0;
+    }
+    if (delay + pulse > SAMPLE_SAFE_COUNT || head - seg_q.tail >= I2S_OUT_SEGMENT_QUEUE_SIZE) {
+        return false;
+    }
+
+    i2s_out_segment_t *seg = &seg_q.seg[head & (I2S_OUT_SEGMENT_QUEUE_SIZE - 1)];
+    seg->port_data  = atomic_load(&i2s_out_port_data);
+    seg->step_set   = step_set;
+    seg->step_clear = step_clear;
+    seg->delay      = delay;
+    seg->pulse      = pulse;
+    seg->idle       = i2s_segment_idle(i2s_out_pulse_period, delay + pulse);
+    // Round the idle run up so that all records of a batch start in the buffer being filled.
+    seg_q.budget -= delay + pulse + (seg->idle + I2S_OUT_USEC_PER_PULSE - 1) / I2S_OUT_USEC_PER_PULSE;
+    seg_q.head = head + 1;
+
+    return true;
+}
+
+bool IRAM_ATTR i2s_out_segment_room (void)
+{
+    return i2s_out_pulser_status == STEPPING && seg_q.budget > 0 && seg_q.head - seg_q.tail < I2S_OUT_SEGMENT_QUEUE_SIZE;
+}
+
+void i2s_out_get_stats (i2s_out_stats_t *stats_out)
+{
+    *stats_out = stats;
+    stats_out->buffers = dma_cfg.count;
+    stats_out->buffer_us = dma_cfg.len / I2S_SAMPLE_SIZE * I2S_OUT_USEC_PER_PULSE;
+}
+
+uint32_t i2s_out_get_latency_us (void)
+{
+    return (dma_cfg.count + 1) * (dma_cfg.len / I2S_SAMPLE_SIZE) * I2S_OUT_USEC_PER_PULSE;
+}
+
+void i2s_out_reset_stats (void)
+{
+    I2S_OUT_PULSER_ENTER_CRITICAL();
+    memset(&stats, 0, sizeof(i2s_out_stats_t));
+    stats.headroom_min = dma_cfg.count;
+    I2S_OUT_PULSER_EXIT_CRITICAL();
+}
+
 i2s_out_pulser_status_t IRAM_ATTR i2s_out_get_pulser_status (void)
 {
     I2S_OUT_PULSER_ENTER_CRITICAL();
@@ -582,7 +754,7 @@ void IRAM_ATTR i2s_out_set_passthrough (void)
     I2S_OUT_PULSER_ENTER_CRITICAL();
     if (i2s_out_pulser_status == STEPPING) {
         i2s_out_pulser_status = WAITING;  // Start stopping the pulser
-        delay(I2S_OUT_DELAY_MS);
+        delay(dma_cfg.delay_ms);
     }
     I2S_OUT_PULSER_EXIT_CRITICAL();
 }
@@ -601,7 +773,7 @@ void IRAM_ATTR i2s_out_set_stepping (void)
         // Wait for complete DMAs
         for (;;) {
             I2S_OUT_PULSER_EXIT_CRITICAL();
-            delay(I2S_OUT_DELAY_DMABUF_MS);
+            delay(dma_cfg.buf_ms);
             I2S_OUT_PULSER_ENTER_CRITICAL();
             if (i2s_out_pulser_status == WAITING) {
                 continue;
@@ -620,6 +792,7 @@ void IRAM_ATTR i2s_out_set_stepping (void)
     i2s_out_stop();
     uint32_t port_data = atomic_load(&i2s_out_port_data);
     i2s_clear_o_dma_buffers(port_data);
+    seg_q.tail = seg_q.head;
 
     // You need to set the status before calling i2s_out_start()
     // because the process in i2s_out_start() is different depending on the status.
@@ -642,6 +815,7 @@ void IRAM_ATTR i2s_out_reset (void)
 {
     I2S_OUT_PULSER_ENTER_CRITICAL();
     i2s_out_stop();
+    seg_q.tail = seg_q.head;  // Drop the queued step segment records
     if (i2s_out_pulser_status == STEPPING) {
         uint32_t port_data = atomic_load(&i2s_out_port_data);
         i2s_clear_o_dma_buffers(port_data);
@@ -700,24 +874,24 @@ bool IRAM_ATTR i2s_out_init2 (i2s_out_init_t init_param)
    */
 
     // Allocate the array of pointers to the buffers
-    o_dma.buffers = (uint32_t **)malloc(sizeof(uint32_t *)*I2S_OUT_DMABUF_COUNT);
+    o_dma.buffers = (uint32_t **)malloc(sizeof(uint32_t *)*dma_cfg.count);
     if (o_dma.buffers == NULL)
         return -1;
 
     // Allocate each buffer that can be used by the DMA controller
-    for (int buf_idx = 0; buf_idx < I2S_OUT_DMABUF_COUNT; buf_idx++) {
-        o_dma.buffers[buf_idx] = (uint32_t *)heap_caps_calloc(1, I2S_OUT_DMABUF_LEN, MALLOC_CAP_DMA);
+    for (int buf_idx = 0; buf_idx < dma_cfg.count; buf_idx++) {
+        o_dma.buffers[buf_idx] = (uint32_t *)heap_caps_calloc(1, dma_cfg.len, MALLOC_CAP_DMA);
         if (o_dma.buffers[buf_idx] == NULL)
             return -1;
     }
 
     // Allocate the array of DMA descriptors
-    o_dma.desc = (lldesc_t**)malloc(sizeof(lldesc_t *)*I2S_OUT_DMABUF_COUNT);
+    o_dma.desc = (lldesc_t**)malloc(sizeof(lldesc_t *)*dma_cfg.count);
     if (o_dma.desc == NULL)
         return -1;
 
     // Allocate each DMA descriptor that will be used by the DMA controller
-    for (int buf_idx = 0; buf_idx < I2S_OUT_DMABUF_COUNT; buf_idx++) {
+    for (int buf_idx = 0; buf_idx < dma_cfg.count; buf_idx++) {
         o_dma.desc[buf_idx] = (lldesc_t *)heap_caps_malloc(sizeof(lldesc_t), MALLOC_CAP_DMA);
         if (o_dma.desc[buf_idx] == NULL)
             return -1;
@@ -727,7 +901,7 @@ bool IRAM_ATTR i2s_out_init2 (i2s_out_init_t init_param)
     i2s_clear_o_dma_buffers(init_param.init_val);
     o_dma.rw_pos  = 0;
     o_dma.current = NULL;
-    o_dma.queue   = xQueueCreate(I2S_OUT_DMABUF_COUNT, sizeof(uint32_t *));
+    o_dma.queue   = xQueueCreate(dma_cfg.count, sizeof(uint32_t *));
 
     // Set the first DMA descriptor
     I2S0.out_link.addr = (uint32_t)o_dma.desc[0];
@@ -903,4 +1077,22 @@ bool IRAM_ATTR i2s_out_init (void)
     return i2s_out_init2(default_param);
 }
 
+/*
+  Select the DMA buffer profile, must be called before i2s_out_init().
+*/
+bool i2s_out_set_dma_profile (i2s_out_dma_profile_t profile)
+{
+    if (i2s_out_initialized || profile > I2SDMA_DeepBuffer)
+        return false;
+
+    dma_cfg.count = dma_profiles[profile].count;
+    dma_cfg.len = dma_profiles[profile].len;
+    // Round up, the delays are used to wait for the output to be reflected
+    dma_cfg.buf_ms = (dma_cfg.len / I2S_SAMPLE_SIZE * I2S_OUT_USEC_PER_PULSE + 999) / 1000;
+    dma_cfg.delay_ms = ((dma_cfg.count + 1) * (dma_cfg.len / I2S_SAMPLE_SIZE) * I2S_OUT_USEC_PER_PULSE + 999) / 1000;
+    stats.headroom_min = dma_cfg.count;
+
+    return true;
+}
+
 #endif
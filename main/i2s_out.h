@@ -59,12 +59,32 @@
 /* 32-bit mode: 1000000 usec / ((160000000 Hz) /  5 / 2) x 32 bit/pulse x 2(stereo) = 4 usec/pulse */
 #define I2S_OUT_USEC_PER_PULSE 4
 
+#define I2S_OUT_DELAY_SAMPLES_MAX 2 /* longest direction setup time for a step record, in samples */
+#define I2S_OUT_PULSE_SAMPLES_MAX 4 /* longest step pulse for a step record, in samples */
+
+#define I2S_OUT_SEGMENT_QUEUE_SIZE 32 /* step segment records per DMA buffer fill, must be a power of 2 */
+
 #define I2S_OUT_DMABUF_COUNT 5  /* number of DMA buffers to store data */
 #define I2S_OUT_DMABUF_LEN 2000 /* maximum size in bytes (4092 is DMA's limit) */
 
 #define I2S_OUT_DELAY_DMABUF_MS (I2S_OUT_DMABUF_LEN / sizeof(uint32_t) * I2S_OUT_USEC_PER_PULSE / 1000)
 #define I2S_OUT_DELAY_MS (I2S_OUT_DELAY_DMABUF_MS * (I2S_OUT_DMABUF_COUNT + 1))
 
+#define I2S_OUT_DMABUF_COUNT_LOW_LATENCY 4  /* 0.4 ms per buffer, about 2 ms output latency */
+#define I2S_OUT_DMABUF_LEN_LOW_LATENCY 400
+#define I2S_OUT_DMABUF_COUNT_DEEP 10        /* 4 ms per buffer, about 44 ms output latency */
+#define I2S_OUT_DMABUF_LEN_DEEP 4000
+
+#ifndef I2S_OUT_DMA_PROFILE
+#define I2S_OUT_DMA_PROFILE 0 // I2SDMA_Normal
+#endif
+
+typedef enum {
+    I2SDMA_Normal = 0,  // I2S_OUT_DMABUF_COUNT x I2S_OUT_DMABUF_LEN
+    I2SDMA_LowLatency,  // Faster feed hold and passthrough switching, more prone to underflow
+    I2SDMA_DeepBuffer   // Underflow resistant, slower feed hold and passthrough switching
+} i2s_out_dma_profile_t;
+
 typedef void (*i2s_out_pulse_func_t)(void);
 
 typedef struct {
@@ -109,6 +129,12 @@ typedef struct {
 */
 bool i2s_out_init (void);
 
+/*
+  Select the DMA buffer count and size to be allocated by i2s_out_init().
+  return false ... already initialized or invalid profile
+*/
+bool i2s_out_set_dma_profile (i2s_out_dma_profile_t profile);
+
 void i2s_set_step_mask (void);
 
 
@@ -118,6 +144,11 @@ void i2s_set_step_mask (void);
 */
 bool i2s_out_state (uint8_t pin);
 
+/*
+  Get all bits of the internal pin state var.
+*/
+uint32_t i2s_out_get_state (void);
+
 /*
    Set a bit in the internal pin state var. (not written electrically)
    pin: expanded pin No. (0..31)
@@ -125,6 +156,13 @@ bool i2s_out_state (uint8_t pin);
 */
 void i2s_out_write(uint8_t pin, uint8_t val);
 
+/*
+   Set and clear several bits in the internal pin state var in one operation. (not written electrically)
+   set:   bits to set, bit0 is expanded pin 0
+   clear: bits to clear
+*/
+void i2s_out_write_masked (uint32_t set, uint32_t clear);
+
 
 void i2s_out_commit (uint8_t pulse, uint8_t delay);
 
@@ -138,6 +176,39 @@ void i2s_out_commit (uint8_t pulse, uint8_t delay);
  */
 uint32_t i2s_out_push_sample (uint32_t num);
 
+/*
+    Push a complete step record to the I2S bitstream buffer:
+    delay samples of the current pin state (direction setup time) followed by
+    pulse samples with the step bits applied, the internal pin state var is not changed.
+    step_set:   step bits to set during the pulse
+    step_clear: step bits to clear during the pulse (inverted outputs)
+    delay, pulse: number of samples, the sum is limited to the buffer margin,
+                  at least I2S_OUT_DELAY_SAMPLES_MAX + I2S_OUT_PULSE_SAMPLES_MAX
+    return: number of pushed samples
+            0 .. no space for push
+ */
+uint32_t i2s_out_push_pulse (uint32_t step_set, uint32_t step_clear, uint32_t delay, uint32_t pulse);
+
+/*
+    Queue a step segment record for one step period, to be called from the pulse callback.
+    The record is expanded by the DMA buffer filler as delay samples of the current pin state
+    (direction setup time), pulse samples with the step bits applied and an idle run of the
+    current pin state making up the remainder of the step period set by i2s_out_set_pulse_period().
+    The pin state is captured when the record is queued.
+    step_set:   step bits to set during the pulse
+    step_clear: step bits to clear during the pulse (inverted outputs)
+    delay, pulse: number of samples, pulse is 0 for a period without steps.
+    return: false .. the record is dropped, queue full or the sum of delay and pulse too large
+ */
+bool i2s_out_push_segment (uint32_t step_set, uint32_t step_clear, uint32_t delay, uint32_t pulse);
+
+/*
+    Check if the pulse callback may queue another step segment record,
+    returns false when the queue is full, the records queued cover the space left
+    in the DMA buffer being filled or the pulser is no longer stepping.
+ */
+bool i2s_out_segment_room (void);
+
 /*
    Set pulser mode to passtrough
    After this function is called,
@@ -182,6 +253,27 @@ typedef enum  {
 
 i2s_out_pulser_status_t i2s_out_get_pulser_status (void);
 
+/*
+   Bitstream telemetry, only updated while stepping
+ */
+typedef struct {
+    uint32_t buffers;           // number of DMA buffers allocated
+    uint32_t buffer_us;         // time to transfer one buffer
+    uint32_t underflows;        // buffers sent with static port data as the bitstream task fell behind, steps may be lost
+    uint32_t fills;             // number of buffers filled
+    uint32_t fill_cycles_max;   // worst case time to fill a buffer, CPU cycles
+    uint32_t headroom_min;      // minimum number of filled buffers queued ahead of the DMA
+} i2s_out_stats_t;
+
+void i2s_out_get_stats (i2s_out_stats_t *stats);
+void i2s_out_reset_stats (void);
+
+/*
+   Get the worst case time from a sample being generated to it being output while stepping,
+   the time to transfer all the DMA buffers.
+ */
+uint32_t i2s_out_get_latency_us (void);
+
 /*
    Reset i2s I/O expander
    - Stop ISR/DMA
@@ -68,6 +68,8 @@
 #include "esp_intr_alloc.h"
 #include "soc/gdma_periph.h"
 #include "soc/system_reg.h"
+#include <xtensa/core-macros.h>
+#include <string.h>
 #include <stdatomic.h>
 
 #include "i2s_out.h"
@@ -87,12 +89,19 @@
 // but on the other hand, it leads to a delay with pulse and/or non-pulse-generated I/Os.
 // The number of I2S_OUT_DMABUF_COUNT should be chosen carefully.
 //
+// The buffer count and size are selected at run time by i2s_out_set_dma_profile(),
+// I2S_OUT_DMABUF_COUNT and I2S_OUT_DMABUF_LEN are the normal profile.
+//
 // Reference information:
 //   FreeRTOS task time slice = portTICK_PERIOD_MS = 1 ms (ESP32 FreeRTOS port)
 //
 #define I2S_SAMPLE_SIZE 4                                       /* 4 bytes, 32 bits per sample */
-#define DMA_SAMPLE_COUNT (I2S_OUT_DMABUF_LEN / I2S_SAMPLE_SIZE) /* number of samples per buffer */
+#define DMA_SAMPLE_COUNT (dma_cfg.len / I2S_SAMPLE_SIZE)        /* number of samples per buffer */
+#if (20 / I2S_OUT_USEC_PER_PULSE) > (I2S_OUT_DELAY_SAMPLES_MAX + I2S_OUT_PULSE_SAMPLES_MAX)
 #define SAMPLE_SAFE_COUNT (20 / I2S_OUT_USEC_PER_PULSE)         /* prevent buffer overrun (GRBL's $0 should be less than or equal 20) */
+#else
+#define SAMPLE_SAFE_COUNT (I2S_OUT_DELAY_SAMPLES_MAX + I2S_OUT_PULSE_SAMPLES_MAX) /* prevent buffer overrun, a step record must fit */
+#endif
 #define DMA_SAMPLE_COUNT_PASSTROUGH 12
 #ifndef I2S_OUT_INIT_VAL
 #define I2S_OUT_INIT_VAL 0
@@ -134,6 +143,47 @@ typedef struct {
     dma_descriptor_t *descr[I2S_LOCAL_QUEUE];
 } i2s_dma_queue_t;
 
+typedef struct {
+    uint32_t port_data;     // pin state when queued
+    uint32_t step_set;      // step bits to set during the pulse
+    uint32_t step_clear;    // step bits to clear during the pulse
+    uint16_t delay;         // direction setup samples
+    uint16_t pulse;         // pulse samples, 0 for a step period without steps
+    uint32_t idle;          // time remaining of the step period after the pulse (usec)
+} i2s_out_segment_t;
+
+// Step segment records, queued by the pulse callback and expanded by the DMA buffer filler.
+// Both run in the bitstream task, the tail is only changed with the pulser lock held.
+typedef struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    int32_t budget;         // samples left in the buffer being filled not yet claimed by queued records
+    uint32_t idle_data;     // pin state for the idle run following the last expanded record
+    i2s_out_segment_t seg[I2S_OUT_SEGMENT_QUEUE_SIZE];
+} i2s_out_segment_queue_t;
+
+#if I2S_OUT_SEGMENT_QUEUE_SIZE & (I2S_OUT_SEGMENT_QUEUE_SIZE - 1)
+#error "I2S_OUT_SEGMENT_QUEUE_SIZE must be a power of 2"
+#endif
+
+typedef struct {
+    uint32_t count;     // number of DMA buffers
+    uint32_t len;       // size of each DMA buffer in bytes (4092 is DMA's limit)
+    uint32_t buf_ms;    // time to transfer one buffer
+    uint32_t delay_ms;  // time to transfer all the buffers
+} i2s_out_dma_cfg_t;
+
+static const i2s_out_dma_cfg_t dma_profiles[] = {
+    [I2SDMA_Normal]     = { I2S_OUT_DMABUF_COUNT, I2S_OUT_DMABUF_LEN },
+    [I2SDMA_LowLatency] = { I2S_OUT_DMABUF_COUNT_LOW_LATENCY, I2S_OUT_DMABUF_LEN_LOW_LATENCY },
+    [I2SDMA_DeepBuffer] = { I2S_OUT_DMABUF_COUNT_DEEP, I2S_OUT_DMABUF_LEN_DEEP }
+};
+
+static i2s_out_dma_cfg_t dma_cfg = { I2S_OUT_DMABUF_COUNT, I2S_OUT_DMABUF_LEN, I2S_OUT_DELAY_DMABUF_MS, I2S_OUT_DELAY_MS };
+
+static i2s_out_stats_t stats = { .headroom_min = I2S_OUT_DMABUF_COUNT };
+static i2s_out_segment_queue_t seg_q;
+
 static const DRAM_ATTR uint32_t i2s_tx_int_flags = GDMA_LL_EVENT_TX_DONE|GDMA_LL_EVENT_TX_TOTAL_EOF;
 
 #if I2S_LOCAL_QUEUE
@@ -227,22 +277,22 @@ static inline void IRAM_ATTR i2s_clear_dma_buffer (dma_descriptor_t *dma_desc, u
     } while(--i);
     // Restore the buffer length.
     // The length may have been changed short when the data was filled in to prevent buffer overrun.
-    dma_desc->dw0.length = I2S_OUT_DMABUF_LEN;
+    dma_desc->dw0.length = dma_cfg.len;
 }
 
 static void IRAM_ATTR i2s_clear_o_dma_buffers (uint32_t port_data)
 {
-    for(int i = 0; i < I2S_OUT_DMABUF_COUNT; i++) {
+    for(int i = 0; i < dma_cfg.count; i++) {
 
         // Initialize DMA descriptor
         memset(i2s_sr.dma.desc[i], 0, sizeof(dma_descriptor_t));
 
         i2s_sr.dma.desc[i]->dw0.owner = 1;
         i2s_sr.dma.desc[i]->dw0.suc_eof = 1;
-        i2s_sr.dma.desc[i]->dw0.length = I2S_OUT_DMABUF_LEN;
-        i2s_sr.dma.desc[i]->dw0.size = I2S_OUT_DMABUF_LEN;
+        i2s_sr.dma.desc[i]->dw0.length = dma_cfg.len;
+        i2s_sr.dma.desc[i]->dw0.size = dma_cfg.len;
         i2s_sr.dma.desc[i]->buffer = i2s_sr.dma.buffers[i];
-        i2s_sr.dma.desc[i]->next = (dma_descriptor_t *)((i < (I2S_OUT_DMABUF_COUNT - 1)) ? (i2s_sr.dma.desc[i + 1]) : i2s_sr.dma.desc[0]);
+        i2s_sr.dma.desc[i]->next = (dma_descriptor_t *)((i < (dma_cfg.count - 1)) ? (i2s_sr.dma.desc[i + 1]) : i2s_sr.dma.desc[0]);
 
         i2s_clear_dma_buffer(i2s_sr.dma.desc[i], port_data);
     }
@@ -378,6 +428,7 @@ static bool IRAM_ATTR i2s_out_start (i2s_out_pulser_status_t pulser_status)
 #if I2S_LOCAL_QUEUE
         dma_queue.tail = dma_queue.head;
 #endif
+        seg_q.tail = seg_q.head;
         i2s_sr.dma.rw_pos = 0;
         i2s_sr.dma.current = i2s_sr.dma.desc[0]->buffer;
     }
@@ -448,9 +499,10 @@ static void IRAM_ATTR i2s_out_intr_handler (void *arg)
 
                 front_desc = dma_queue.descr[dma_queue.tail++];
 
-
-                if(i2s_sr.pulser_status == STEPPING)
+                if(i2s_sr.pulser_status == STEPPING) {
                     port_data = atomic_load(&i2s_sr.port_data);
+                    stats.underflows++;
+                }
 
 
                 i2s_clear_dma_buffer(front_desc, port_data);
@@ -462,6 +514,12 @@ static void IRAM_ATTR i2s_out_intr_handler (void *arg)
             if((dma_queue.descr[dma_queue.head] = finish_desc) > 100)
                 dma_queue.head = qptr;
 
+            if(i2s_sr.pulser_status == STEPPING) {
+                uint32_t headroom = dma_cfg.count - ((dma_queue.head - dma_queue.tail) & (I2S_LOCAL_QUEUE - 1));
+                if(headroom < stats.headroom_min)
+                    stats.headroom_min = headroom;
+            }
+
             I2S_OUT_PULSER_EXIT_CRITICAL_ISR();
 
 #else
@@ -473,8 +531,10 @@ static void IRAM_ATTR i2s_out_intr_handler (void *arg)
 
                 I2S_OUT_PULSER_ENTER_CRITICAL_ISR();
 
-                if(i2s_sr.pulser_status == STEPPING)
+                if(i2s_sr.pulser_status == STEPPING) {
                     port_data = atomic_load(&i2s_sr.port_data);
+                    stats.underflows++;
+                }
 
                 I2S_OUT_PULSER_EXIT_CRITICAL_ISR();
 
@@ -484,6 +544,12 @@ static void IRAM_ATTR i2s_out_intr_handler (void *arg)
             // Send a DMA complete event to the I2S bitstreamer task with finished buffer
             xQueueSendFromISR(i2s_sr.dma.queue, &finish_desc, &high_priority_task_awoken);
 
+            if(i2s_sr.pulser_status == STEPPING) {
+                uint32_t headroom = dma_cfg.count - uxQueueMessagesWaitingFromISR(i2s_sr.dma.queue);
+                if(headroom < stats.headroom_min)
+                    stats.headroom_min = headroom;
+            }
+
 #endif
         }
     }
@@ -494,9 +560,33 @@ static void IRAM_ATTR i2s_out_intr_handler (void *arg)
         portYIELD_FROM_ISR();
 }
 
+// Block fill of a run of identical samples
+static inline void IRAM_ATTR i2s_fill_samples (uint32_t *buf, uint32_t port_data, uint32_t n)
+{
+    while (n >= 4) {
+        buf[0] = port_data;
+        buf[1] = port_data;
+        buf[2] = port_data;
+        buf[3] = port_data;
+        buf += 4;
+        n -= 4;
+    }
+    while (n--) {
+        *buf++ = port_data;
+    }
+}
+
+// Time remaining of a step period after the direction setup and pulse samples
+static inline uint32_t IRAM_ATTR i2s_segment_idle (uint32_t period, uint32_t samples)
+{
+    return period >= I2S_OUT_USEC_PER_PULSE * samples ? period - I2S_OUT_USEC_PER_PULSE * samples : I2S_OUT_USEC_PER_PULSE; // too fast!
+}
+
+// Called with the pulser lock held, the lock is released while the pulse callback runs
+// as the callback may change the pulser status.
 static void IRAM_ATTR i2s_fillout_dma_buffer (dma_descriptor_t *dma_desc)
 {
-    uint32_t *buf = (uint32_t *)dma_desc->buffer;
+    uint32_t *buf = (uint32_t *)dma_desc->buffer, n;
 
     // It reuses the oldest (just transferred) buffer with the name "current"
     // and fills the buffer for later DMA.
@@ -513,35 +603,49 @@ static void IRAM_ATTR i2s_fillout_dma_buffer (dma_descriptor_t *dma_desc)
     // the generation of the buffer is interrupted (the buffer length is shortened slightly)
     // and the pulse generation is postponed until the next buffer is filled.
     //
+    // The pulse callback queues step segment records, each a short direction setup and pulse
+    // pattern followed by an idle run up to the next step period. The filler expands the records
+    // with block fills and only calls back when the queue is empty.
+    //
     while (i2s_sr.dma.rw_pos < (DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT)) {
 
         // no data to read (buffer empty)
         if (i2s_sr.remain_time_until_next_pulse < I2S_OUT_USEC_PER_PULSE) {
 
+            if (seg_q.tail != seg_q.head) {
+                // expand the next step segment record
+                i2s_out_segment_t *seg = &seg_q.seg[seg_q.tail & (I2S_OUT_SEGMENT_QUEUE_SIZE - 1)];
+                i2s_fill_samples(&buf[i2s_sr.dma.rw_pos], seg->port_data, seg->delay);
+                i2s_fill_samples(&buf[i2s_sr.dma.rw_pos + seg->delay], (seg->port_data & ~seg->step_clear) | seg->step_set, seg->pulse);
+                i2s_sr.dma.rw_pos += seg->delay + seg->pulse;
+                i2s_sr.remain_time_until_next_pulse += seg->idle;
+                seg_q.idle_data = seg->port_data;
+                seg_q.tail++;
+                continue;
+            }
+
             // pulser status may change in pulse phase func, so I need to check it every time.
             if (i2s_sr.pulser_status == STEPPING) {
 
                 // fillout future DMA buffer (tail of the DMA buffer chains)
 
-                uint32_t old_rw_pos = i2s_sr.dma.rw_pos, period;
+                uint32_t old_rw_pos = i2s_sr.dma.rw_pos;
+
+                seg_q.budget = DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT - i2s_sr.dma.rw_pos;
 
                 I2S_OUT_PULSER_EXIT_CRITICAL();   // Temporarily unlocked status lock as it may be locked in pulse callback.
 
-                i2s_sr.pulse_func();              // Insert steps.
+                i2s_sr.pulse_func();              // Queue step segment records or insert steps.
 
                 I2S_OUT_PULSER_ENTER_CRITICAL();  // Lock again.
 
-                period = I2S_OUT_USEC_PER_PULSE * (i2s_sr.dma.rw_pos - old_rw_pos);
-
-                // Calculate pulse period.
-                if(i2s_sr.pulse_period >= period)
-                    i2s_sr.remain_time_until_next_pulse += i2s_sr.pulse_period - period;
-                else // too fast!
-                    i2s_sr.remain_time_until_next_pulse += I2S_OUT_USEC_PER_PULSE;
+                // Calculate pulse period for samples pushed directly.
+                if(seg_q.tail == seg_q.head)
+                    i2s_sr.remain_time_until_next_pulse += i2s_segment_idle(i2s_sr.pulse_period, i2s_sr.dma.rw_pos - old_rw_pos);
 
                 if (i2s_sr.pulser_status == WAITING) {
                     // i2s_out_set_passthrough() has called from the pulse function.
-                    // It needs to go into pass-through mode.
+                    // It needs to go into pass-through mode, the records queued before are expanded first.
                     // This DMA descriptor must be a tail of the chain.
                     dma_desc->dw0.suc_eof = 1; //?
                     dma_desc->next = NULL;  // Cut the DMA descriptor ring. This allow us to identify the tail of the buffer.
@@ -550,20 +654,27 @@ static void IRAM_ATTR i2s_fillout_dma_buffer (dma_descriptor_t *dma_desc)
                     // I2S has already in static mode, and buffers has cleared to zero.
                     // To prevent the pulse function from being called back,
                     // we assume that the buffer is already full.
+                    seg_q.tail                          = seg_q.head;        // Drop the queued records.
                     i2s_sr.remain_time_until_next_pulse = 0;                 // There is no need to fill the current buffer.
                     i2s_sr.dma.rw_pos                   = DMA_SAMPLE_COUNT;  // The buffer is full.
                     break;
                 }
                 continue;
             }
-        }
-        // no pulse data in push buffer (pulse off or idle or callback is not defined)
-        buf[i2s_sr.dma.rw_pos++] = atomic_load(&i2s_sr.port_data);
-        if (i2s_sr.remain_time_until_next_pulse >= I2S_OUT_USEC_PER_PULSE) {
-            i2s_sr.remain_time_until_next_pulse -= I2S_OUT_USEC_PER_PULSE;
-        } else {
+            // no pulse data in push buffer (pulse off or callback is not defined), pad the rest of the buffer
+            n = DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT - i2s_sr.dma.rw_pos;
             i2s_sr.remain_time_until_next_pulse = 0;
+        } else {
+            // idle run up to the next pulse or the end of the buffer
+            n = i2s_sr.remain_time_until_next_pulse / I2S_OUT_USEC_PER_PULSE;
+            if (n > DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT - i2s_sr.dma.rw_pos)
+                n = DMA_SAMPLE_COUNT - SAMPLE_SAFE_COUNT - i2s_sr.dma.rw_pos;
+            i2s_sr.remain_time_until_next_pulse -= n * I2S_OUT_USEC_PER_PULSE;
         }
+        // Direction changes for records still queued are already applied to the pin state,
+        // the idle run between records keeps the state of the record it follows.
+        i2s_fill_samples(&buf[i2s_sr.dma.rw_pos], seg_q.tail != seg_q.head ? seg_q.idle_data : atomic_load(&i2s_sr.port_data), n);
+        i2s_sr.dma.rw_pos += n;
     }
     // set filled length to the DMA descriptor
     dma_desc->dw0.length = i2s_sr.dma.rw_pos * I2S_SAMPLE_SIZE;
@@ -592,8 +703,13 @@ static inline void i2s_step_gen (dma_descriptor_t *dma_desc)
         // the generation of the buffer is interrupted (the buffer length is shortened slightly)
         // and the pulse generation is postponed until the next buffer is filled.
         //
+        uint32_t cycles = XTHAL_GET_CCOUNT();
         i2s_fillout_dma_buffer(dma_desc);
         dma_desc->dw0.length = i2s_sr.dma.rw_pos * I2S_SAMPLE_SIZE;
+        cycles = XTHAL_GET_CCOUNT() - cycles;
+        stats.fills++;
+        if(cycles > stats.fill_cycles_max)
+            stats.fill_cycles_max = cycles;
     } else if (i2s_sr.pulser_status == WAITING) {
         if (dma_desc->next == NULL) {
             // Tail of the DMA descriptor found
@@ -683,7 +799,7 @@ void IRAM_ATTR i2s_out_delay (void)
     } else {
         // Just wait until the data now registered in the DMA descripter
         // is reflected in the I2S TX module via FIFO.
-        delay(I2S_OUT_DELAY_MS);
+        delay(dma_cfg.delay_ms);
     }
 
     I2S_OUT_PULSER_EXIT_CRITICAL();
@@ -707,6 +823,18 @@ void IRAM_ATTR i2s_out_write (uint8_t pin, uint8_t val)
 //    pd = atomic_load(&i2s_sr.port_data);
 }
 
+void IRAM_ATTR i2s_out_write_masked (uint32_t set, uint32_t clear)
+{
+    uint32_t data = atomic_load(&i2s_sr.port_data);
+
+    while(!atomic_compare_exchange_weak(&i2s_sr.port_data, &data, (data & ~clear) | set));
+
+    if(i2s_sr.pulser_status == PASSTHROUGH) {
+        data = atomic_load(&i2s_sr.port_data);
+        *(uint32_t *)i2s_sr.dma.idle->buffer = data & ~i2s_sr.step_mask;
+    }
+}
+
 void IRAM_ATTR i2s_out_commit (uint8_t pulse, uint8_t delay)
 {
     dma_descriptor_t *desc;
@@ -749,6 +877,11 @@ bool IRAM_ATTR i2s_out_state (uint8_t pin)
     return !!(port_data & bit(pin));
 }
 
+uint32_t IRAM_ATTR i2s_out_get_state (void)
+{
+    return atomic_load(&i2s_sr.port_data);
+}
+
 uint32_t IRAM_ATTR i2s_out_push_sample (uint32_t num)
 {
     if(num > SAMPLE_SAFE_COUNT)
@@ -764,6 +897,74 @@ uint32_t IRAM_ATTR i2s_out_push_sample (uint32_t num)
     return num;
 }
 
+uint32_t IRAM_ATTR i2s_out_push_pulse (uint32_t step_set, uint32_t step_clear, uint32_t delay, uint32_t pulse)
+{
+    if(delay + pulse > SAMPLE_SAFE_COUNT || pulse == 0)
+        return 0;
+
+    uint32_t port_data = atomic_load(&i2s_sr.port_data);
+    uint32_t *buf = &i2s_sr.dma.current[i2s_sr.dma.rw_pos];
+
+    i2s_fill_samples(buf, port_data, delay);
+    i2s_fill_samples(buf + delay, (port_data & ~step_clear) | step_set, pulse);
+    i2s_sr.dma.rw_pos += delay + pulse;
+
+    return delay + pulse;
+}
+
+bool IRAM_ATTR i2s_out_push_segment (uint32_t step_set, uint32_t step_clear, uint32_t delay, uint32_t pulse)
+{
+    uint32_t head = seg_q.head;
+
+    if(pulse == 0)
+        delay = 0;
+
+    if(delay + pulse > SAMPLE_SAFE_COUNT || head - seg_q.tail >= I2S_OUT_SEGMENT_QUEUE_SIZE)
+        return false;
+
+    i2s_out_segment_t *seg = &seg_q.seg[head & (I2S_OUT_SEGMENT_QUEUE_SIZE - 1)];
+
+    seg->port_data  = atomic_load(&i2s_sr.port_data);
+    seg->step_set   = step_set;
+    seg->step_clear = step_clear;
+    seg->delay      = delay;
+    seg->pulse      = pulse;
+    seg->idle       = i2s_segment_idle(i2s_sr.pulse_period, delay + pulse);
+
+    // Round the idle run up so that all records of a batch start in the buffer being filled.
+    seg_q.budget -= delay + pulse + (seg->idle + I2S_OUT_USEC_PER_PULSE - 1) / I2S_OUT_USEC_PER_PULSE;
+    seg_q.head = head + 1;
+
+    return true;
+}
+
+bool IRAM_ATTR i2s_out_segment_room (void)
+{
+    return i2s_sr.pulser_status == STEPPING && seg_q.budget > 0 && seg_q.head - seg_q.tail < I2S_OUT_SEGMENT_QUEUE_SIZE;
+}
+
+void i2s_out_get_stats (i2s_out_stats_t *stats_out)
+{
+    *stats_out = stats;
+    stats_out->buffers = dma_cfg.count;
+    stats_out->buffer_us = dma_cfg.len / I2S_SAMPLE_SIZE * I2S_OUT_USEC_PER_PULSE;
+}
+
+uint32_t i2s_out_get_latency_us (void)
+{
+    return (dma_cfg.count + 1) * (dma_cfg.len / I2S_SAMPLE_SIZE) * I2S_OUT_USEC_PER_PULSE;
+}
+
+void i2s_out_reset_stats (void)
+{
+    I2S_OUT_PULSER_ENTER_CRITICAL();
+
+    memset(&stats, 0, sizeof(i2s_out_stats_t));
+    stats.headroom_min = dma_cfg.count;
+
+    I2S_OUT_PULSER_EXIT_CRITICAL();
+}
+
 i2s_out_pulser_status_t IRAM_ATTR i2s_out_get_pulser_status (void)
 {
     I2S_OUT_PULSER_ENTER_CRITICAL();
@@ -781,7 +982,7 @@ void IRAM_ATTR i2s_out_set_passthrough (void)
 
     if (i2s_sr.pulser_status == STEPPING) {
         i2s_sr.pulser_status = WAITING;  // Start stopping the pulser
-        delay(I2S_OUT_DELAY_MS);
+        delay(dma_cfg.delay_ms);
     }
 
     I2S_OUT_PULSER_EXIT_CRITICAL();
@@ -803,7 +1004,7 @@ void IRAM_ATTR i2s_out_set_stepping (void)
     // Wait for complete DMAs
     while(i2s_sr.pulser_status == WAITING) {
         I2S_OUT_PULSER_EXIT_CRITICAL();
-        delay(I2S_OUT_DELAY_DMABUF_MS);
+        delay(dma_cfg.buf_ms);
         I2S_OUT_PULSER_ENTER_CRITICAL();
     }
 
@@ -827,6 +1028,8 @@ void IRAM_ATTR i2s_out_reset (void)
 {
     I2S_OUT_PULSER_ENTER_CRITICAL();
 
+    seg_q.tail = seg_q.head;  // Drop the queued step segment records
+
     if (i2s_sr.pulser_status == STEPPING) {
         uint32_t port_data = atomic_load(&i2s_sr.port_data);
         i2s_clear_o_dma_buffers(port_data);
@@ -891,21 +1094,21 @@ bool IRAM_ATTR i2s_out_init2 (i2s_out_init_t init_param)
     i2s_out_gpio_attach(init_param.ws_pin, init_param.bck_pin, init_param.data_pin);
 
     // Allocate the array of pointers to the buffers
-    if((i2s_sr.dma.buffers = (uint32_t **)malloc(sizeof(uint32_t *) * I2S_OUT_DMABUF_COUNT)) == NULL)
+    if((i2s_sr.dma.buffers = (uint32_t **)malloc(sizeof(uint32_t *) * dma_cfg.count)) == NULL)
         return false;
 
     // Allocate each buffer that can be used by the DMA controller
-    for(int i = 0; i < I2S_OUT_DMABUF_COUNT; i++) {
-        if((i2s_sr.dma.buffers[i] = (uint32_t *)heap_caps_calloc(1, I2S_OUT_DMABUF_LEN, MALLOC_CAP_DMA)) == NULL)
+    for(int i = 0; i < dma_cfg.count; i++) {
+        if((i2s_sr.dma.buffers[i] = (uint32_t *)heap_caps_calloc(1, dma_cfg.len, MALLOC_CAP_DMA)) == NULL)
             return false;
     }
 
     // Allocate the array of DMA descriptors
-    if((i2s_sr.dma.desc = (dma_descriptor_t **)malloc(sizeof(dma_descriptor_t *) * I2S_OUT_DMABUF_COUNT)) == NULL)
+    if((i2s_sr.dma.desc = (dma_descriptor_t **)malloc(sizeof(dma_descriptor_t *) * dma_cfg.count)) == NULL)
         return false;
 
     // Allocate each DMA descriptor that will be used by the DMA controller
-    for(int i = 0; i < I2S_OUT_DMABUF_COUNT; i++) {
+    for(int i = 0; i < dma_cfg.count; i++) {
         if((i2s_sr.dma.desc[i] = (dma_descriptor_t *)heap_caps_malloc(sizeof(dma_descriptor_t), MALLOC_CAP_DMA)) == NULL)
             return false;
     }
@@ -918,7 +1121,7 @@ bool IRAM_ATTR i2s_out_init2 (i2s_out_init_t init_param)
     i2s_sr.dma.rw_pos  = 0;
     i2s_sr.dma.current = NULL;
 #if !I2S_LOCAL_QUEUE
-    i2s_sr.dma.queue   = xQueueCreate(I2S_OUT_DMABUF_COUNT, sizeof(uint32_t *));
+    i2s_sr.dma.queue   = xQueueCreate(dma_cfg.count, sizeof(uint32_t *));
 #endif
 
     i2s_ll_tx_stop(&I2S0);
@@ -1024,4 +1227,22 @@ bool IRAM_ATTR i2s_out_init (void)
     return i2s_out_init2(default_param);
 }
 
+/*
+  Select the DMA buffer profile, must be called before i2s_out_init().
+*/
+bool i2s_out_set_dma_profile (i2s_out_dma_profile_t profile)
+{
+    if(i2s_sr.initialized || profile > I2SDMA_DeepBuffer)
+        return false;
+
+    dma_cfg.count = dma_profiles[profile].count;
+    dma_cfg.len = dma_profiles[profile].len;
+    // Round up, the delays are used to wait for the output to be reflected
+    dma_cfg.buf_ms = (dma_cfg.len / I2S_SAMPLE_SIZE * I2S_OUT_USEC_PER_PULSE + 999) / 1000;
+    dma_cfg.delay_ms = ((dma_cfg.count + 1) * (dma_cfg.len / I2S_SAMPLE_SIZE) * I2S_OUT_USEC_PER_PULSE + 999) / 1000;
+    stats.headroom_min = dma_cfg.count;
+
+    return true;
+}
+
 #endif
@@ -28,6 +28,9 @@
 #include "grbl/protocol.h"
 #include "grbl/settings.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 #if USE_I2S_OUT
 #include "i2s_out.h"
 #endif
@@ -36,6 +39,10 @@ static io_ports_data_t digital;
 static input_signal_t *aux_in;
 static output_signal_t *aux_out;
 static volatile input_signal_t *event_port;
+static volatile TaskHandle_t event_task = NULL;
+
+#define WAIT_SLICE_MS 10 // max. time between realtime command checks while waiting on an input
+#define WAIT_MIN_MS   50 // added to the timeout, a wait with a 0 timeout still waits this long
 
 static bool digital_out_cfg (xbar_t *output, gpio_out_config_t *config, bool persistent)
 {
@@ -105,58 +112,57 @@ static float digital_in_state (xbar_t *input)
     return value;
 }
 
+// Edge waits, and level waits on inputs without an interrupt handler attached, sleep on a
+// task notification given by ioports_event() and wake up to service realtime commands.
 inline static __attribute__((always_inline)) int32_t get_input (const input_signal_t *input, wait_mode_t wait_mode, float timeout)
 {
     if(wait_mode == WaitMode_Immediate)
         return DIGITAL_IN(input->pin) ^ input->mode.inverted;
 
     int32_t value = -1;
-    uint_fast16_t delay = (uint_fast16_t)ceilf((1000.0f / 50.0f) * timeout) + 1;
-
-    if(wait_mode == WaitMode_Rise || wait_mode == WaitMode_Fall) {
-
-        pin_irq_mode_t irq_mode = wait_mode == WaitMode_Rise ? IRQ_Mode_Rising : IRQ_Mode_Falling;
-
-        if(input->cap.irq_mode & irq_mode) {
-
-            event_port = NULL;
-            gpio_set_intr_type(input->pin, map_intr_type(irq_mode));
-            gpio_intr_enable(input->pin);
+    bool edge = wait_mode == WaitMode_Rise || wait_mode == WaitMode_Fall, wait_for = wait_mode != WaitMode_Low, use_irq;
+    pin_irq_mode_t irq_mode;
+    TickType_t start = xTaskGetTickCount(), ticks = pdMS_TO_TICKS((uint32_t)ceilf(timeout * 1000.0f) + WAIT_MIN_MS);
+
+    if(edge)
+        irq_mode = wait_mode == WaitMode_Rise ? IRQ_Mode_Rising : IRQ_Mode_Falling;
+    else // arm the edge that takes the input to the level waited for
+        irq_mode = wait_for != input->mode.inverted ? IRQ_Mode_Rising : IRQ_Mode_Falling;
+
+    use_irq = !!(input->cap.irq_mode & irq_mode) && (edge || input->mode.irq_mode == IRQ_Mode_None);
+
+    if(edge && !use_irq)
+        return value;
+
+    if(use_irq) {
+        event_port = NULL;
+        event_task = xTaskGetCurrentTaskHandle();
+        ulTaskNotifyTake(pdTRUE, 0);
+        gpio_set_intr_type(input->pin, map_intr_type(irq_mode));
+        gpio_intr_enable(input->pin);
+    }
 
-            do {
-                if(event_port == input) {
-                    value = gpio_get_level(input->pin) ^ input->mode.inverted;
-                    break;
-                }
-                if(delay) {
-                    protocol_execute_realtime();
-                    hal.delay_ms(50, NULL);
-                } else
-                    break;
-            } while(--delay && !sys.abort);
-
-            // Restore pin interrupt status
-            if(input->mode.irq_mode == IRQ_Mode_None) {
-                gpio_intr_disable(input->pin);
-            } else
-                gpio_set_intr_type(input->pin, map_intr_type(input->mode.irq_mode));
+    do {
+        if(edge ? event_port == input : (gpio_get_level(input->pin) ^ input->mode.inverted) == wait_for) {
+            value = gpio_get_level(input->pin) ^ input->mode.inverted;
+            break;
         }
-
-    } else {
-
-        bool wait_for = wait_mode != WaitMode_Low;
-
-        do {
-            if((gpio_get_level(input->pin) ^ input->mode.inverted) == wait_for) {
-                value = gpio_get_level(input->pin) ^ input->mode.inverted;
-                break;
-            }
-            if(delay) {
-                protocol_execute_realtime();
-                hal.delay_ms(50, NULL);
-            } else
-                break;
-        } while(--delay && !sys.abort);
+        if(xTaskGetTickCount() - start >= ticks)
+            break;
+        protocol_execute_realtime();
+        if(use_irq)
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WAIT_SLICE_MS));
+        else
+            hal.delay_ms(WAIT_SLICE_MS, NULL);
+    } while(!sys.abort);
+
+    if(use_irq) {
+        event_task = NULL;
+        // Restore pin interrupt status
+        if(input->mode.irq_mode == IRQ_Mode_None) {
+            gpio_intr_disable(input->pin);
+        } else
+            gpio_set_intr_type(input->pin, map_intr_type(input->mode.irq_mode));
     }
 
     return value;
@@ -176,8 +182,20 @@ IRAM_ATTR static int32_t wait_on_input (io_port_type_t type, uint8_t port, wait_
 
 IRAM_ATTR void ioports_event (input_signal_t *input)
 {
+    TaskHandle_t task;
+
     event_port = input;
 
+    if((task = event_task)) {
+        if(xPortInIsrContext()) {
+            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+            vTaskNotifyGiveFromISR(task, &xHigherPriorityTaskWoken);
+            if(xHigherPriorityTaskWoken)
+                portYIELD_FROM_ISR();
+        } else
+            xTaskNotifyGive(task);
+    }
+
     if(input->interrupt_callback)
         input->interrupt_callback(input->user_port, DIGITAL_IN(input->pin));
 }
@@ -21,6 +21,13 @@
 
 #include "driver.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
 #include "grbl/ioports.h"
 
 #ifdef AUXOUTPUT0_PWM_PIN
@@ -90,6 +97,249 @@ static const adc_map_t adc_map[] = {
 };
 
 #endif
+
+#ifndef AUX_ANALOG_SAMPLE_US
+#define AUX_ANALOG_SAMPLE_US 1000       // sample period, all channels are sampled each period
+#endif
+
+#ifndef AUX_ANALOG_FILTER
+#define AUX_ANALOG_FILTER 1             // 0: none, 1: moving average, 2: median
+#endif
+
+#ifndef AUX_ANALOG_FILTER_SIZE
+#define AUX_ANALOG_FILTER_SIZE 8        // number of samples in the filter window, max 16
+#endif
+
+// The ADC channels are sampled continuously by the ADC DMA controller and filtered, reads return the
+// latest filtered value. On the ESP32 ADC DMA is driven by the I2S0 peripheral, when this is used for
+// the I2S output expander the channels are sampled by a periodic timer instead.
+
+#ifndef AUX_ANALOG_DMA
+#if CONFIG_IDF_TARGET_ESP32S3 || !USE_I2S_OUT
+#define AUX_ANALOG_DMA 1
+#else
+#define AUX_ANALOG_DMA 0
+#endif
+#endif
+
+#if AUX_ANALOG_DMA
+
+#define ADC_DMA_FRAME_SIZE 256          // bytes per DMA conversion frame
+
+#if CONFIG_IDF_TARGET_ESP32
+#define ADC_DMA_FORMAT ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define ADC_DMA_RESULT_BYTES 2
+#define ADC_DMA_MIN_FREQ 20000          // sample rate limits, Hz
+#define ADC_DMA_MAX_FREQ 2000000
+#define ADC_DMA_CONV_LIMIT true         // must be enabled on the ESP32
+#define ADC_DMA_CHANNEL(p) (p)->type1.channel
+#define ADC_DMA_DATA(p) (p)->type1.data
+#else
+#define ADC_DMA_FORMAT ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define ADC_DMA_RESULT_BYTES 4
+#define ADC_DMA_MIN_FREQ 611
+#define ADC_DMA_MAX_FREQ 83333
+#define ADC_DMA_CONV_LIMIT false
+#define ADC_DMA_CHANNEL(p) (p)->type2.channel
+#define ADC_DMA_DATA(p) (p)->type2.data
+#endif
+
+#endif // AUX_ANALOG_DMA
+
+typedef struct {
+    const adc_map_t *adc;
+    uint8_t port;                       // index in aux_in_analog
+    uint_fast8_t head;
+    uint32_t sum;
+    uint16_t sample[AUX_ANALOG_FILTER_SIZE];
+    volatile int32_t value;             // filtered value
+} analog_channel_t;
+
+static uint_fast8_t n_channels = 0;
+static analog_channel_t *channel = NULL;
+#if AUX_ANALOG_DMA
+static TaskHandle_t sampler = NULL;
+static int8_t adc_channel[SOC_ADC_CHANNEL_NUM(0)];   // ADC1 channel to index in channel, -1 if not sampled
+#else
+static esp_timer_handle_t sampler = NULL;
+#endif
+
+#if AUX_ANALOG_FILTER == 2
+
+static int32_t filter_median (analog_channel_t *ch)
+{
+    uint16_t v, sorted[AUX_ANALOG_FILTER_SIZE];
+    int_fast8_t i, j;
+
+    for(i = 0; i < AUX_ANALOG_FILTER_SIZE; i++) {
+        v = ch->sample[i];
+        for(j = i - 1; j >= 0 && sorted[j] > v; j--)
+            sorted[j + 1] = sorted[j];
+        sorted[j + 1] = v;
+    }
+
+    return sorted[AUX_ANALOG_FILTER_SIZE / 2];
+}
+
+#endif
+
+static void analog_filter_add (analog_channel_t *ch, uint16_t raw)
+{
+#if AUX_ANALOG_FILTER == 0
+    ch->value = raw;
+#else
+    ch->sum += raw - ch->sample[ch->head];
+    ch->sample[ch->head] = raw;
+    ch->head = (ch->head + 1) % AUX_ANALOG_FILTER_SIZE;
+  #if AUX_ANALOG_FILTER == 1
+    ch->value = ch->sum / AUX_ANALOG_FILTER_SIZE;
+  #else
+    ch->value = filter_median(ch);
+  #endif
+#endif
+}
+
+#if AUX_ANALOG_DMA
+
+static void analog_sample (void *arg)
+{
+    uint8_t frame[ADC_DMA_FRAME_SIZE] __attribute__((aligned(4)));
+    uint32_t idx, length;
+    adc_digi_output_data_t *result;
+
+    while(true) {
+        if(adc_digi_read_bytes(frame, sizeof(frame), &length, ADC_MAX_DELAY) == ESP_OK) {
+            for(idx = 0; idx < length; idx += ADC_DMA_RESULT_BYTES) {
+                result = (adc_digi_output_data_t *)&frame[idx];
+                if(ADC_DMA_CHANNEL(result) < SOC_ADC_CHANNEL_NUM(0) && adc_channel[ADC_DMA_CHANNEL(result)] >= 0)
+                    analog_filter_add(&channel[adc_channel[ADC_DMA_CHANNEL(result)]], ADC_DMA_DATA(result));
+            }
+        }
+    }
+}
+
+#else
+
+static void analog_sample (void *arg)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < n_channels; idx++)
+        analog_filter_add(&channel[idx], (uint16_t)adc1_get_raw(channel[idx].adc->ch));
+}
+
+#endif // AUX_ANALOG_DMA
+
+static void analog_sampler_add (uint8_t port)
+{
+    analog_channel_t *ch;
+
+    if((ch = realloc(channel, (n_channels + 1) * sizeof(analog_channel_t))) == NULL)
+        return;
+
+    channel = ch;
+    ch = &channel[n_channels];
+
+    memset(ch, 0, sizeof(analog_channel_t));
+    ch->adc = aux_in_analog[port].adc;
+    ch->port = port;
+    ch->value = adc1_get_raw(ch->adc->ch);
+
+    // Prime the filter window to avoid a ramp up from 0
+    for(ch->head = 0; ch->head < AUX_ANALOG_FILTER_SIZE; ch->head++) {
+        ch->sample[ch->head] = (uint16_t)ch->value;
+        ch->sum += ch->value;
+    }
+    ch->head = 0;
+
+    n_channels++;
+}
+
+#if AUX_ANALOG_DMA
+
+static bool analog_sampler_start (void)
+{
+    if(n_channels && sampler == NULL) {
+
+        uint_fast8_t idx;
+        uint32_t adc1_chan_mask = 0, freq = n_channels * (1000000UL / AUX_ANALOG_SAMPLE_US);
+        adc_digi_pattern_config_t pattern[SOC_ADC_PATT_LEN_MAX] = {0};
+
+        memset(adc_channel, -1, sizeof(adc_channel));
+
+        for(idx = 0; idx < n_channels && idx < SOC_ADC_PATT_LEN_MAX; idx++) {
+            adc_channel[channel[idx].adc->ch] = idx;
+            adc1_chan_mask |= BIT(channel[idx].adc->ch);
+            pattern[idx].atten = ADC_ATTEN_DB_11;
+            pattern[idx].channel = channel[idx].adc->ch;
+            pattern[idx].unit = 0;
+            pattern[idx].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+        }
+
+        adc_digi_init_config_t init = {
+            .max_store_buf_size = ADC_DMA_FRAME_SIZE * 4,
+            .conv_num_each_intr = ADC_DMA_FRAME_SIZE,
+            .adc1_chan_mask = adc1_chan_mask,
+            .adc2_chan_mask = 0
+        };
+
+        adc_digi_configuration_t config = {
+            .conv_limit_en = ADC_DMA_CONV_LIMIT,
+            .conv_limit_num = 250,
+            .pattern_num = idx,
+            .adc_pattern = pattern,
+            .sample_freq_hz = freq < ADC_DMA_MIN_FREQ ? ADC_DMA_MIN_FREQ : (freq > ADC_DMA_MAX_FREQ ? ADC_DMA_MAX_FREQ : freq),
+            .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+            .format = ADC_DMA_FORMAT
+        };
+
+        if(adc_digi_initialize(&init) != ESP_OK)
+            return false;
+
+        if(adc_digi_controller_configure(&config) != ESP_OK ||
+            xTaskCreatePinnedToCore(analog_sample, "analog in", 3072, NULL, GRBLHAL_TASK_PRIORITY - 1, &sampler, GRBLHAL_TASK_CORE) != pdPASS) {
+            sampler = NULL;
+            adc_digi_deinitialize();
+        } else
+            adc_digi_start();
+    }
+
+    return sampler != NULL;
+}
+
+#else
+
+static bool analog_sampler_start (void)
+{
+    if(n_channels && sampler == NULL) {
+
+        esp_timer_create_args_t args = {
+            .callback = analog_sample,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "analog in"
+        };
+
+        if(esp_timer_create(&args, &sampler) != ESP_OK || esp_timer_start_periodic(sampler, AUX_ANALOG_SAMPLE_US) != ESP_OK)
+            sampler = NULL;
+    }
+
+    return sampler != NULL;
+}
+
+#endif // AUX_ANALOG_DMA
+
+static analog_channel_t *get_channel (uint8_t port)
+{
+    uint_fast8_t idx = n_channels;
+
+    while(idx) {
+        if(channel[--idx].port == port)
+            return &channel[idx];
+    }
+
+    return NULL;
+}
+
 #endif // AUX_ANALOG_IN
 
 #ifdef MCP3221_ENABLE
@@ -341,8 +591,13 @@ static int32_t wait_on_input (io_port_type_t type, uint8_t port, wait_mode_t wai
     else
 #endif
 
-    if(port < analog.in.n_ports && aux_in_analog[port].adc)
-        value = adc1_get_raw(aux_in_analog[port].adc->ch);
+    if(port < analog.in.n_ports && aux_in_analog[port].adc) {
+        analog_channel_t *ch;
+        if(sampler && (ch = get_channel(port)))
+            value = ch->value;
+        else
+            value = adc1_get_raw(aux_in_analog[port].adc->ch);
+    }
 
     return value;
 }
@@ -548,13 +803,14 @@ void ioports_init_analog (pin_group_pins_t *aux_inputs, pin_group_pins_t *aux_ou
             for(i = 0; i < p_pins; i++) {
 
                 ok = false;
-                for(j = 0; i < sizeof(adc_map) / sizeof(adc_map_t); j++) {
+                for(j = 0; j < sizeof(adc_map) / sizeof(adc_map_t); j++) {
 
-                    if((ok = adc_map[i].pin == aux_in_analog[i].pin)) {
+                    if((ok = adc_map[j].pin == aux_in_analog[i].pin)) {
                         adc1_config_width(ADC_WIDTH_BIT_DEFAULT);
-                        adc1_config_channel_atten(adc_map[i].ch, ADC_ATTEN_DB_11);
-                        aux_in_analog[i].adc = &adc_map[i];
+                        adc1_config_channel_atten(adc_map[j].ch, ADC_ATTEN_DB_11);
+                        aux_in_analog[i].adc = &adc_map[j];
                         aux_in_analog[i].cap.analog = On;
+                        analog_sampler_add(i);
                         break;
                     }
                 }
@@ -565,6 +821,7 @@ void ioports_init_analog (pin_group_pins_t *aux_inputs, pin_group_pins_t *aux_ou
 
 
         if(analog.in.n_ports) {
+            analog_sampler_start();
             if((wait_on_input_digital = hal.port.wait_on_input) == NULL)
                 wait_on_input_digital = wait_on_input_dummy;
             hal.port.wait_on_input = wait_on_input;
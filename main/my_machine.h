@@ -71,7 +71,7 @@
                                     // 2: Mode switching is by the CMD_MPG_MODE_TOGGLE command character. The keypad plugin is not required.
 //#define KEYPAD_ENABLE           1 // 1: uses a I2C keypad for input.
                                     // 2: uses a serial port for input. If MPG_ENABLE is set to 1 the serial stream is shared with the MPG.
-//#define PPI_ENABLE              1 // Laser PPI plugin. To be completed.
+//#define PPI_ENABLE              1 // Laser PPI plugin. Requires the PWM spindle, pulses are timed by timer group 1 timer 0.
 //#define LASER_COOLANT_ENABLE    1 // Laser coolant plugin. To be completed.
 //#define LB_CLUSTERS_ENABLE      1 // LaserBurn cluster support.
 //#define FANS_ENABLE             1 // Enable fan control via M106/M107. Enables fans plugin.
@@ -85,6 +85,22 @@
 #define ESTOP_ENABLE            0 // When enabled only real-time report requests will be executed when the reset pin is asserted.
                                     // NOTE: if left commented out the default setting is determined from COMPATIBILITY_LEVEL.
 //#define PROBE_ENABLE            0 // Uncomment to disable probe input.
+//#define HANDWHEEL_ENABLE        1 // Quadrature MPG handwheel input counted by PCNT, generates jog moves. Requires a board map with
+                                    // HANDWHEEL_A_PIN and HANDWHEEL_B_PIN, axis and step size selectors are claimed from the aux inputs.
+//#define AXIS_ENCODERS_ENABLE    1 // Axis encoders counted by PCNT for lost step detection, raises a following error alarm or warning.
+                                    // Requires a board map with <axis>_ENCODER_A_PIN, <axis>_ENCODER_B_PIN and <axis>_ENCODER_RESOLUTION.
+//#define SPINDLE_ENCODER_ENABLE  1 // PCNT based spindle encoder for RPM and angular position reporting. Requires a board map with SPINDLE_PULSE_PIN,
+                                    // optionally SPINDLE_INDEX_PIN and SPINDLE_PULSE_B_PIN for a quadrature encoder.
+                                    // NOTE: spindle synchronized motion (G33, G76) is not supported.
+//#define UART_RX_FIFO_THRESHOLD 32 // UART RX FIFO interrupt threshold, default 64. Lower values give more headroom against FIFO overruns.
+//#define UART_RX_TIMEOUT        10 // UART RX idle timeout in character times, default 10.
+                                    // NOTE: input is still handled per character by the interrupt handler, realtime commands are not parsed
+                                    //       in bulk and UHCI/DMA reception is not supported. Baud rates above 115200 are not verified.
+//#define STEP_TRACE_ENABLE       1 // Log step and direction output events with timestamps, use $STEPTRACE to report.
+                                    // NOTE: for bench testing only, adds overhead to the step interrupt.
+//#define STEP_ISR_STATS_ENABLE   1 // Keep step timer interrupt latency and execution time histograms, use $STEPISR to report.
+//#define RMT_SYNC_START          0 // Set to 0 to start RMT step channels one by one. Sync start requires an ESP32-S3 and is enabled by default there.
+//#define I2S_OUT_DMA_PROFILE     1 // Default I2S DMA buffering for the Setting_I2SDMAProfile driver setting (Setting_DriverStart + 0): 0 = normal, 1 = low latency, 2 = deep buffer.
 
 // Optional control signals:
 // These will be assigned to aux input pins. Use the $pins command to check which pins are assigned.
@@ -0,0 +1,88 @@
+/*
+
+  pcnt_count.h - driver code for ESP32
+
+  Encoder count arithmetic, free of hardware dependencies so that it can be unit tested on the host.
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _PCNT_COUNT_H_
+#define _PCNT_COUNT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The 16 bit hardware counter is cleared when it reaches +/- this value, the wraps are accumulated in software.
+#define PCNT_ENCODER_LIMIT 16000
+
+// Unit status register limit event bits, same values as PCNT_EVT_L_LIM and PCNT_EVT_H_LIM.
+#define PCNT_COUNT_STATUS_L_LIM 0x10
+#define PCNT_COUNT_STATUS_H_LIM 0x20
+
+// Forced inline as the functions are called from IRAM resident code.
+#define PCNT_COUNT_INLINE static inline __attribute__((always_inline))
+
+// Returns the count change of the limit event latched in the unit status register.
+PCNT_COUNT_INLINE int32_t pcnt_count_limit_event (uint32_t status)
+{
+    return (status & PCNT_COUNT_STATUS_H_LIM) ? PCNT_ENCODER_LIMIT : ((status & PCNT_COUNT_STATUS_L_LIM) ? -PCNT_ENCODER_LIMIT : 0);
+}
+
+/*
+  Combine the accumulated wraps with a hardware counter read.
+  accumulated: wraps accumulated by the interrupt handler
+  count:       hardware counter value
+  pending:     true if the limit interrupt was raised but not yet handled, the counter has then
+               been cleared and the wrap is taken from the latched status
+  status:      unit status register
+*/
+PCNT_COUNT_INLINE int32_t pcnt_count_combine (int32_t accumulated, int16_t count, bool pending, uint32_t status)
+{
+    return (int32_t)((uint32_t)accumulated + (uint32_t)(int32_t)count + (uint32_t)(pending ? pcnt_count_limit_event(status) : 0));
+}
+
+// Signed distance between two 32 bit counts, correct across the 32 bit wrap.
+PCNT_COUNT_INLINE int32_t pcnt_count_delta (int32_t count, int32_t from)
+{
+    return (int32_t)((uint32_t)count - (uint32_t)from);
+}
+
+// Returns true if the counts between two index pulses differs from counts_per_rev by more than tolerance.
+PCNT_COUNT_INLINE bool pcnt_count_index_error (int32_t count, int32_t count_at_index, uint32_t counts_per_rev, uint32_t tolerance)
+{
+    int32_t delta = pcnt_count_delta(count, count_at_index);
+
+    if(delta < 0)
+        delta = -delta;
+
+    delta -= (int32_t)counts_per_rev;
+
+    return (uint32_t)(delta < 0 ? -delta : delta) > tolerance;
+}
+
+// Returns the angular position in revolutions from the index pulse count and the counts since the last index pulse.
+PCNT_COUNT_INLINE float pcnt_count_angular_position (uint32_t index_count, int32_t count, int32_t count_at_index, float revs_per_count)
+{
+    int32_t delta = pcnt_count_delta(count, count_at_index);
+
+    return (float)index_count + (float)(delta < 0 ? -delta : delta) * revs_per_count;
+}
+
+#endif
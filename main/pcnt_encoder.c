@@ -0,0 +1,148 @@
+/*
+
+  pcnt_encoder.c - driver code for ESP32
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "soc/pcnt_struct.h"
+
+#include "pcnt_encoder.h"
+
+// A single interrupt handler is used for all units instead of the driver ISR service as the
+// service clears the interrupt before calling the unit handler, leaving a window where a
+// reader on the other core sees neither the pending wrap nor the updated accumulated count.
+// The lock is held while the wrap is accumulated and the interrupt cleared, readers then check
+// the raw interrupt status of the unit to add a wrap that has not yet been handled.
+
+static portMUX_TYPE pcnt_lock = portMUX_INITIALIZER_UNLOCKED;
+static pcnt_isr_handle_t isr_handle = NULL;
+static pcnt_encoder_t *encoders[PCNT_UNIT_MAX] = {0};
+
+IRAM_ATTR static void pcnt_encoder_isr (void *arg)
+{
+    uint32_t unit, intr_status;
+
+    portENTER_CRITICAL_ISR(&pcnt_lock);
+
+    intr_status = PCNT.int_st.val;
+
+    for(unit = 0; unit < PCNT_UNIT_MAX; unit++) {
+        if((intr_status & BIT(unit)) && encoders[unit])
+            encoders[unit]->accumulated += pcnt_count_limit_event(PCNT.status_unit[unit].val);
+    }
+
+    PCNT.int_clr.val = intr_status;
+
+    portEXIT_CRITICAL_ISR(&pcnt_lock);
+}
+
+bool pcnt_encoder_init (pcnt_encoder_t *encoder, pcnt_unit_t unit, uint8_t pin_a, uint8_t pin_b, uint16_t filter)
+{
+    pcnt_config_t config = {
+        .pulse_gpio_num = pin_a,
+        .ctrl_gpio_num = pin_b == PCNT_ENCODER_NO_PIN ? PCNT_PIN_NOT_USED : pin_b,
+        .channel = PCNT_CHANNEL_0,
+        .unit = unit,
+        .pos_mode = PCNT_COUNT_INC,
+        .neg_mode = pin_b == PCNT_ENCODER_NO_PIN ? PCNT_COUNT_DIS : PCNT_COUNT_DEC,
+        .lctrl_mode = pin_b == PCNT_ENCODER_NO_PIN ? PCNT_MODE_KEEP : PCNT_MODE_REVERSE,
+        .hctrl_mode = PCNT_MODE_KEEP,
+        .counter_h_lim = PCNT_ENCODER_LIMIT,
+        .counter_l_lim = -PCNT_ENCODER_LIMIT
+    };
+
+    encoder->unit = unit;
+    encoder->accumulated = 0;
+
+    if(pcnt_unit_config(&config) != ESP_OK)
+        return false;
+
+    if(pin_b != PCNT_ENCODER_NO_PIN) {
+        config.pulse_gpio_num = pin_b;
+        config.ctrl_gpio_num = pin_a;
+        config.channel = PCNT_CHANNEL_1;
+        config.pos_mode = PCNT_COUNT_DEC;
+        config.neg_mode = PCNT_COUNT_INC;
+        if(pcnt_unit_config(&config) != ESP_OK)
+            return false;
+    }
+
+    if(filter) {
+        pcnt_set_filter_value(unit, filter > 1023 ? 1023 : filter);
+        pcnt_filter_enable(unit);
+    } else
+        pcnt_filter_disable(unit);
+
+    pcnt_event_enable(unit, PCNT_EVT_H_LIM);
+    pcnt_event_enable(unit, PCNT_EVT_L_LIM);
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+
+    if(isr_handle == NULL && pcnt_isr_register(pcnt_encoder_isr, NULL, ESP_INTR_FLAG_IRAM, &isr_handle) != ESP_OK)
+        return false;
+
+    portENTER_CRITICAL(&pcnt_lock);
+    encoders[unit] = encoder;
+    PCNT.int_clr.val = BIT(unit);
+    portEXIT_CRITICAL(&pcnt_lock);
+
+    pcnt_intr_enable(unit);
+    pcnt_counter_resume(unit);
+
+    return true;
+}
+
+IRAM_ATTR int32_t pcnt_encoder_get_count (pcnt_encoder_t *encoder)
+{
+    bool pending;
+    int16_t count;
+    int32_t accumulated;
+    uint32_t status, mask = BIT(encoder->unit);
+
+    portENTER_CRITICAL_SAFE(&pcnt_lock);
+
+    accumulated = encoder->accumulated;
+
+    // Retry if the counter reached a limit while reading, the count is then from before the wrap.
+    do {
+        pending = !!(PCNT.int_raw.val & mask);
+        count = (int16_t)PCNT.cnt_unit[encoder->unit].cnt_val;
+        status = PCNT.status_unit[encoder->unit].val;
+    } while(pending != !!(PCNT.int_raw.val & mask));
+
+    portEXIT_CRITICAL_SAFE(&pcnt_lock);
+
+    return pcnt_count_combine(accumulated, count, pending, status);
+}
+
+void pcnt_encoder_reset (pcnt_encoder_t *encoder)
+{
+    pcnt_counter_pause(encoder->unit);
+    pcnt_counter_clear(encoder->unit);
+
+    portENTER_CRITICAL(&pcnt_lock);
+    encoder->accumulated = 0;
+    PCNT.int_clr.val = BIT(encoder->unit);
+    portEXIT_CRITICAL(&pcnt_lock);
+
+    pcnt_counter_resume(encoder->unit);
+}
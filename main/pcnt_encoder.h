@@ -0,0 +1,56 @@
+/*
+
+  pcnt_encoder.h - driver code for ESP32
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _PCNT_ENCODER_H_
+#define _PCNT_ENCODER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "driver/pcnt.h"
+
+#include "pcnt_count.h"
+
+#define PCNT_ENCODER_NO_PIN 0xFF
+
+typedef struct {
+    pcnt_unit_t unit;
+    volatile int32_t accumulated;
+} pcnt_encoder_t;
+
+/*
+  Configure a PCNT unit for an encoder.
+  pin_a:  pulse input, or phase A of a quadrature encoder
+  pin_b:  phase B of a quadrature encoder, PCNT_ENCODER_NO_PIN for a single pulse input
+          counting rising edges only
+  filter: glitch filter in APB clock cycles, pulses shorter than this are ignored, 0 to disable
+  Quadrature encoders are counted on all edges of both phases, 4 counts per line.
+*/
+bool pcnt_encoder_init (pcnt_encoder_t *encoder, pcnt_unit_t unit, uint8_t pin_a, uint8_t pin_b, uint16_t filter);
+
+// Get the 32 bit count, IRAM resident and may be called from interrupt context.
+int32_t pcnt_encoder_get_count (pcnt_encoder_t *encoder);
+
+void pcnt_encoder_reset (pcnt_encoder_t *encoder);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+
+  stream_buffer.h - driver code for ESP32
+
+  Single producer, single consumer input buffer handling shared by the driver streams
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _STREAM_BUFFER_H_
+#define _STREAM_BUFFER_H_
+
+#include <string.h>
+
+#include "esp_attr.h"
+
+#include "grbl/hal.h"
+
+// The producer (an interrupt handler or a stack callback) updates head and the consumer
+// (the foreground process) updates tail, so no locking is required. The head is published
+// after the data is written with a fence in between as producer and consumer may run on
+// different cores.
+// The exception is rx_buffer_cancel() which updates both, it is called by the realtime command
+// handler on CMD_STOP from the producer context. The producer therefore publishes head for each
+// character added and reads it back before adding the next so that a cancel is not undone.
+// NOTE: RX_BUFFER_SIZE must be a power of 2.
+
+#define RX_BUFFER_MASK (RX_BUFFER_SIZE - 1)
+
+/*** Producer side ***/
+
+// Adds characters not claimed by the realtime command handler to the buffer,
+// returns the number of characters dropped due to the buffer being full.
+FORCE_INLINE_ATTR uint_fast16_t rx_buffer_enqueue (stream_rx_buffer_t *rxbuf, const uint8_t *data, uint_fast16_t length, enqueue_realtime_command_ptr enqueue_rt)
+{
+    uint_fast16_t head, tail = rxbuf->tail, next_head, dropped = 0;
+
+    while(length--) {
+        if(!enqueue_rt((char)*data)) {
+            head = rxbuf->head;
+            next_head = (head + 1) & RX_BUFFER_MASK;
+            if(next_head == tail && (tail = rxbuf->tail) == next_head)  // If buffer full (reload tail before giving up)
+                dropped++;
+            else {
+                rxbuf->data[head] = (char)*data;
+                __atomic_thread_fence(__ATOMIC_RELEASE);
+                rxbuf->head = next_head;
+            }
+        }
+        data++;
+    }
+
+    if(dropped)
+        rxbuf->overflow = On;
+
+    return dropped;
+}
+
+/*** Consumer side ***/
+
+FORCE_INLINE_ATTR uint16_t rx_buffer_count (stream_rx_buffer_t *rxbuf)
+{
+    uint_fast16_t head = rxbuf->head, tail = rxbuf->tail;
+
+    return (uint16_t)BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+}
+
+FORCE_INLINE_ATTR uint16_t rx_buffer_free (stream_rx_buffer_t *rxbuf)
+{
+    return (RX_BUFFER_SIZE - 1) - rx_buffer_count(rxbuf);
+}
+
+// Returns -1 if no data available
+FORCE_INLINE_ATTR int16_t rx_buffer_getc (stream_rx_buffer_t *rxbuf)
+{
+    uint_fast16_t tail = rxbuf->tail;
+
+    if(tail == rxbuf->head)
+        return -1;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    int16_t data = (uint8_t)rxbuf->data[tail];
+
+    rxbuf->tail = (tail + 1) & RX_BUFFER_MASK;
+
+    return data;
+}
+
+// Copies up to max characters without consuming them, returns the number copied.
+FORCE_INLINE_ATTR uint16_t rx_buffer_peek (stream_rx_buffer_t *rxbuf, char *dst, uint16_t max)
+{
+    uint_fast16_t tail = rxbuf->tail, count = min(rx_buffer_count(rxbuf), max), n;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if((n = min(count, RX_BUFFER_SIZE - tail)))
+        memcpy(dst, &rxbuf->data[tail], n);
+
+    if(count > n)
+        memcpy(dst + n, rxbuf->data, count - n);
+
+    return (uint16_t)count;
+}
+
+// Copies and consumes up to max characters, returns the number copied.
+FORCE_INLINE_ATTR uint16_t rx_buffer_read_n (stream_rx_buffer_t *rxbuf, char *dst, uint16_t max)
+{
+    uint16_t count = rx_buffer_peek(rxbuf, dst, max);
+
+    rxbuf->tail = (rxbuf->tail + count) & RX_BUFFER_MASK;
+
+    return count;
+}
+
+// Returns the length of the first complete line in the buffer including the terminating LF,
+// 0 if no complete line is available.
+FORCE_INLINE_ATTR uint16_t rx_buffer_line_length (stream_rx_buffer_t *rxbuf)
+{
+    uint_fast16_t tail = rxbuf->tail, head = rxbuf->head, length = 0;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    while(tail != head) {
+        length++;
+        if(rxbuf->data[tail] == ASCII_LF)
+            return (uint16_t)length;
+        tail = (tail + 1) & RX_BUFFER_MASK;
+    }
+
+    return 0;
+}
+
+// Copies and consumes the first complete line if it fits in max characters, returns its length or 0.
+FORCE_INLINE_ATTR uint16_t rx_buffer_read_line (stream_rx_buffer_t *rxbuf, char *dst, uint16_t max)
+{
+    uint16_t length = rx_buffer_line_length(rxbuf);
+
+    return length && length <= max ? rx_buffer_read_n(rxbuf, dst, length) : 0;
+}
+
+FORCE_INLINE_ATTR void rx_buffer_flush (stream_rx_buffer_t *rxbuf)
+{
+    rxbuf->tail = rxbuf->head;
+    rxbuf->overflow = Off;
+}
+
+// Flushes the buffer and adds a CAN character.
+FORCE_INLINE_ATTR void rx_buffer_cancel (stream_rx_buffer_t *rxbuf)
+{
+    rxbuf->data[rxbuf->head] = ASCII_CAN;
+    rxbuf->tail = rxbuf->head;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rxbuf->head = (rxbuf->tail + 1) & RX_BUFFER_MASK;
+}
+
+#endif // _STREAM_BUFFER_H_
@@ -28,6 +28,7 @@
 
 #include "driver.h"
 #include "spi.h"
+#include "uart_serial.h"
 #include "grbl/protocol.h"
 #include "grbl/settings.h"
 
@@ -192,14 +193,17 @@ TMC_uart_write_datagram_t *tmc_uart_read (trinamic_motor_t driver, TMC_uart_read
 
     if(tmc_uart.get_rx_buffer_count() >= 8) {
 
-        wdgr.data[0] = tmc_uart.read();
-        wdgr.data[1] = tmc_uart.read();
-        wdgr.data[2] = tmc_uart.read();
-        wdgr.data[3] = tmc_uart.read();
-        wdgr.data[4] = tmc_uart.read();
-        wdgr.data[5] = tmc_uart.read();
-        wdgr.data[6] = tmc_uart.read();
-        wdgr.data[7] = tmc_uart.read();
+        // Read the datagram in one go if the stream is a driver UART.
+        if(serialReadN(&tmc_uart, (char *)wdgr.data, 8) == 0) {
+            wdgr.data[0] = tmc_uart.read();
+            wdgr.data[1] = tmc_uart.read();
+            wdgr.data[2] = tmc_uart.read();
+            wdgr.data[3] = tmc_uart.read();
+            wdgr.data[4] = tmc_uart.read();
+            wdgr.data[5] = tmc_uart.read();
+            wdgr.data[6] = tmc_uart.read();
+            wdgr.data[7] = tmc_uart.read();
+        }
 
     } else
         wdgr.msg.addr.value = 0xFF;
@@ -43,6 +43,7 @@
 #include "esp_intr_alloc.h"
 
 #include "driver.h"
+#include "stream_buffer.h"
 #include "grbl/hal.h"
 #include "grbl/protocol.h"
 
@@ -50,6 +51,17 @@
 #define ONE_STOP_BITS_CONF 0x1
 #define CONFIG_DISABLE_HAL_LOCKS 1
 
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 1024 // must be a power of 2
+#endif
+#define UART_TX_FIFO_THRESHOLD 32 // TX FIFO empty interrupt is raised when the FIFO holds less characters than this
+#ifndef UART_RX_FIFO_THRESHOLD
+#define UART_RX_FIFO_THRESHOLD 64 // RX FIFO full interrupt is raised when the FIFO holds this many characters, leaves 64 characters headroom for interrupt latency
+#endif
+#ifndef UART_RX_TIMEOUT
+#define UART_RX_TIMEOUT 10        // RX timeout interrupt is raised when the line has been idle for this many character times
+#endif
+
 #define UART_REG_BASE(u)    ((u==0)?DR_REG_UART_BASE:(      (u==1)?DR_REG_UART1_BASE:(    (u==2)?DR_REG_UART2_BASE:0)))
 #define UART_RXD_IDX(u)     ((u==0)?U0RXD_IN_IDX:(          (u==1)?U1RXD_IN_IDX:(         (u==2)?U2RXD_IN_IDX:0)))
 #define UART_TXD_IDX(u)     ((u==0)?U0TXD_OUT_IDX:(         (u==1)?U1TXD_OUT_IDX:(        (u==2)?U2TXD_OUT_IDX:0)))
@@ -57,6 +69,21 @@
 
 typedef void (*uart_isr_ptr)(void *arg);
 
+// Output is buffered and moved to the TX FIFO by the TX FIFO empty interrupt,
+// the interrupt is only enabled when the buffer holds data.
+typedef struct {
+    volatile uint_fast16_t head;
+    volatile uint_fast16_t tail;
+    char data[UART_TX_BUFFER_SIZE];
+} uart_tx_buffer_t;
+
+typedef struct {
+    uint32_t fifo_overflows;    // RX FIFO overruns, characters lost in hardware
+    uint32_t buffer_overflows;  // characters dropped due to the input buffer being full
+    uint32_t frame_errors;
+    uint32_t fifo_max;          // max number of characters read by the interrupt handler in one go
+} uart_rx_stats_t;
+
 typedef struct {
 #if CONFIG_IDF_TARGET_ESP32S3
    uart_dev_t *dev;
@@ -69,6 +96,9 @@ typedef struct {
     uint8_t num;
     intr_handle_t intr_handle;
     uint32_t tx_len;
+    uart_tx_buffer_t *txbuf;
+    portMUX_TYPE tx_mux;
+    uart_rx_stats_t rx_stats;
 } uart_t;
 
 static int16_t serialRead (void);
@@ -97,17 +127,18 @@ static const uart_t _uart_bus_array[3] = {
 
 #endif
 
-static const DRAM_ATTR uint16_t RX_BUFFER_SIZE_MASK = RX_BUFFER_SIZE - 1;
 static const DRAM_ATTR uint32_t rx_int_flags = UART_INTR_RXFIFO_FULL|UART_INTR_RXFIFO_OVF|UART_INTR_RXFIFO_TOUT|UART_INTR_FRAM_ERR;
 
 static uart_t uart1;
 static stream_rx_buffer_t rxbuffer = {0};
+static uart_tx_buffer_t txbuffer = {0};
 static enqueue_realtime_command_ptr enqueue_realtime_command = protocol_enqueue_realtime_command;
 static const io_stream_t *serialInit (uint32_t baud_rate);
 
 #if SERIAL2_ENABLE
 static uart_t uart2;
 static stream_rx_buffer_t rxbuffer2 = {0};
+static uart_tx_buffer_t txbuffer2 = {0};
 static enqueue_realtime_command_ptr enqueue_realtime_command2 = protocol_enqueue_realtime_command;
 static const io_stream_t *serial2Init (uint32_t baud_rate);
 #endif
@@ -115,6 +146,7 @@ static const io_stream_t *serial2Init (uint32_t baud_rate);
 #if SERIAL3_ENABLE
 static uart_t uart3;
 static stream_rx_buffer_t rxbuffer3 = {0};
+static uart_tx_buffer_t txbuffer3 = {0};
 static enqueue_realtime_command_ptr enqueue_realtime_command3 = protocol_enqueue_realtime_command;
 static const io_stream_t *serial3Init (uint32_t baud_rate);
 #endif
@@ -164,6 +196,46 @@ static io_stream_properties_t serial[] = {
 #endif // SERIAL3_ENABLE
 };
 
+static void uart_report_stats (uart_t *uart, bool reset)
+{
+    if(uart->txbuf == NULL) // not claimed
+        return;
+
+    if(reset)
+        memset(&uart->rx_stats, 0, sizeof(uart_rx_stats_t));
+    else {
+        hal.stream.write("[UARTSTATS:");
+        hal.stream.write(uitoa(uart->num));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(uart->rx_stats.fifo_overflows));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(uart->rx_stats.buffer_overflows));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(uart->rx_stats.frame_errors));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(uart->rx_stats.fifo_max));
+        hal.stream.write("]" ASCII_EOL);
+    }
+}
+
+static status_code_t uart_stats_command (sys_state_t state, char *args)
+{
+    bool reset = false;
+
+    if(args && !(reset = (*args == 'R' || *args == 'r')))
+        return Status_InvalidStatement;
+
+    uart_report_stats(&uart1, reset);
+#if SERIAL2_ENABLE
+    uart_report_stats(&uart2, reset);
+#endif
+#if SERIAL3_ENABLE
+    uart_report_stats(&uart3, reset);
+#endif
+
+    return Status_OK;
+}
+
 void serialRegisterStreams (void)
 {
     static io_stream_details_t streams = {
@@ -251,6 +323,17 @@ void serialRegisterStreams (void)
 #endif // SERIAL3_ENABLE
 
     stream_register_streams(&streams);
+
+    static const sys_command_t uart_command_list[] = {
+        {"UARTSTATS", uart_stats_command, { .allow_blocking = On }, { .str = "report UART RX FIFO overruns, buffer overflows, framing errors and max FIFO fill, =R to reset" } }
+    };
+
+    static sys_commands_t uart_commands = {
+        .n_commands = sizeof(uart_command_list) / sizeof(sys_command_t),
+        .commands = uart_command_list
+    };
+
+    system_register_commands(&uart_commands);
 }
 
 static void uartSetBaudRate (uart_t *uart, uint32_t baud_rate)
@@ -346,8 +429,10 @@ static void uartEnableInterrupt (uart_t *uart, uart_isr_ptr isr, bool enable_rx)
     if(!uart->intr_handle)
         esp_intr_alloc(UART_INTR_SOURCE(uart->num), (int)ESP_INTR_FLAG_IRAM, isr, NULL, &uart->intr_handle);
 
-    uart_ll_set_rxfifo_full_thr(uart->dev, 112);
-    uart_ll_set_rx_tout(uart->dev, enable_rx ? 50 : 0);
+    uart_ll_set_rxfifo_full_thr(uart->dev, UART_RX_FIFO_THRESHOLD);
+    uart_ll_set_txfifo_empty_thr(uart->dev, UART_TX_FIFO_THRESHOLD);
+    uart_ll_disable_intr_mask(uart->dev, UART_INTR_TXFIFO_EMPTY);
+    uart_ll_set_rx_tout(uart->dev, enable_rx ? UART_RX_TIMEOUT : 0);
     uart_ll_clr_intsts_mask(uart->dev, rx_int_flags);
     if(enable_rx)
         uart_ll_ena_intr_mask(uart->dev, rx_int_flags);
@@ -393,87 +478,175 @@ FORCE_INLINE_ATTR uint32_t _uart_ll_get_txfifo_count (uart_dev_t *hw)
     return HAL_FORCE_READ_U32_REG_FIELD(hw->status, txfifo_cnt);
 }
 
-// UART0
+static void uart_tx_init (uart_t *uart, uart_tx_buffer_t *txbuf)
+{
+    uart->txbuf = txbuf;
+    uart->tx_mux = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    txbuf->head = txbuf->tail = 0;
+}
 
-IRAM_ATTR static void _uart1_isr (void *arg)
+// Moves buffered output to the TX FIFO, called from the UART interrupt.
+IRAM_ATTR static void uart_tx_fill (uart_t *uart)
 {
-    uint32_t c, cnt = uart_ll_get_rxfifo_len(uart1.dev), iflags = uart_ll_get_intsts_mask(uart1.dev);
+    uart_tx_buffer_t *txbuf = uart->txbuf;
+    uint_fast16_t tail = txbuf->tail, head = txbuf->head;
+    uint32_t room = uart->tx_len - _uart_ll_get_txfifo_count(uart->dev);
 
-    uart_ll_clr_intsts_mask(uart1.dev, iflags);
+    while(room-- && tail != head) {
+        _uart_ll_write_txfifo(uart->dev, txbuf->data[tail]);
+        tail = (tail + 1) & (UART_TX_BUFFER_SIZE - 1);
+    }
 
-    if(iflags & UART_INTR_RXFIFO_OVF)
-        rxbuffer.overflow = On;
+    txbuf->tail = tail;
+
+    portENTER_CRITICAL_ISR(&uart->tx_mux);
+    if(tail == txbuf->head)
+        uart_ll_disable_intr_mask(uart->dev, UART_INTR_TXFIFO_EMPTY);
+    portEXIT_CRITICAL_ISR(&uart->tx_mux);
+}
 
-    while(cnt) {
+// Must be called after the buffer head is updated.
+FORCE_INLINE_ATTR void uart_tx_start (uart_t *uart)
+{
+    portENTER_CRITICAL(&uart->tx_mux);
+    uart_ll_ena_intr_mask(uart->dev, UART_INTR_TXFIFO_EMPTY);
+    portEXIT_CRITICAL(&uart->tx_mux);
+}
 
-        cnt--;
-        c = _uart_ll_read_rxfifo(uart1.dev);
+static bool uart_tx_putc (uart_t *uart, const char c)
+{
+    uart_tx_buffer_t *txbuf = uart->txbuf;
+    uint_fast16_t next_head = (txbuf->head + 1) & (UART_TX_BUFFER_SIZE - 1);
 
-        if(!enqueue_realtime_command(c)) {
+    while(next_head == txbuf->tail) {           // If buffer full
+        uart_tx_start(uart);                    // make sure it is being drained
+        if(!hal.stream_blocking_callback())     // and wait
+            return false;
+    }
 
-            uint32_t bptr = (rxbuffer.head + 1) & RX_BUFFER_SIZE_MASK;  // Get next head pointer
+    txbuf->data[txbuf->head] = c;
+    txbuf->head = next_head;
 
-            if(bptr == rxbuffer.tail)                   // If buffer full
-                rxbuffer.overflow = On;                 // flag overflow,
-            else {
-                rxbuffer.data[rxbuffer.head] = (char)c; // else add data to buffer
-                rxbuffer.head = bptr;                   // and update pointer
-            }
+    uart_tx_start(uart);
+
+    return true;
+}
+
+// Copies as much as the buffer space allows in one go, blocks while the buffer is full.
+static void uart_tx_write (uart_t *uart, const char *s, uint16_t length)
+{
+    uart_tx_buffer_t *txbuf = uart->txbuf;
+    uint_fast16_t head, n;
+
+    // head is read for each chunk as the blocking callback may write to the stream.
+    while(length) {
+
+        head = txbuf->head;
+        n = (txbuf->tail - head - 1) & (UART_TX_BUFFER_SIZE - 1);   // free space
+        n = min(min(n, UART_TX_BUFFER_SIZE - head), length);        // limited to contiguous space and length
+
+        if(n == 0) {
+            uart_tx_start(uart);
+            if(!hal.stream_blocking_callback())
+                return;
+            continue;
         }
+
+        memcpy(&txbuf->data[head], s, n);
+        txbuf->head = (head + n) & (UART_TX_BUFFER_SIZE - 1);
+        s += n;
+        length -= n;
     }
+
+    uart_tx_start(uart);
 }
 
-static uint16_t serialAvailable (void)
+static uint16_t uart_tx_count (uart_t *uart)
 {
-    uint16_t head = rxbuffer.head, tail = rxbuffer.tail;
+    uint_fast16_t head = uart->txbuf->head, tail = uart->txbuf->tail;
 
-    return BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+    return BUFCOUNT(head, tail, UART_TX_BUFFER_SIZE) + (uart_ll_is_tx_idle(uart->dev) ? 0 : (uint16_t)_uart_ll_get_txfifo_count(uart->dev) + 1);
 }
 
-uint16_t static serialTxCount (void)
+static void uart_tx_flush (uart_t *uart)
 {
-    return uart_ll_is_tx_idle(uart1.dev) ? 0 : (uint16_t)_uart_ll_get_txfifo_count(uart1.dev) + 1;
+    portENTER_CRITICAL(&uart->tx_mux);
+    uart_ll_disable_intr_mask(uart->dev, UART_INTR_TXFIFO_EMPTY);
+    uart->txbuf->tail = uart->txbuf->head;
+    portEXIT_CRITICAL(&uart->tx_mux);
+
+    _uart_flush(uart, true);
 }
 
-static uint16_t serialRXFree (void)
+// Common interrupt handler, the FIFO is emptied in one go and then added to the input buffer.
+// NOTE: the realtime command handler may cancel the input buffer (CMD_STOP) while the FIFO data
+//       is processed, rx_buffer_enqueue() publishes head per character so the cancel is kept.
+FORCE_INLINE_ATTR void uart_isr (uart_t *uart, stream_rx_buffer_t *rxbuf, enqueue_realtime_command_ptr enqueue_rt)
 {
-    uint16_t head = rxbuffer.head, tail = rxbuffer.tail;
+    uint8_t data[SOC_UART_FIFO_LEN];
+    uint32_t idx, cnt = uart_ll_get_rxfifo_len(uart->dev), iflags = uart_ll_get_intsts_mask(uart->dev);
+
+    uart_ll_clr_intsts_mask(uart->dev, iflags);
+
+    if(iflags & UART_INTR_TXFIFO_EMPTY)
+        uart_tx_fill(uart);
+
+    if(iflags & UART_INTR_RXFIFO_OVF) {
+        rxbuf->overflow = On;
+        uart->rx_stats.fifo_overflows++;
+    }
+
+    if(iflags & UART_INTR_FRAM_ERR)
+        uart->rx_stats.frame_errors++;
+
+    if(cnt > uart->rx_stats.fifo_max)
+        uart->rx_stats.fifo_max = cnt;
 
-    return (RX_BUFFER_SIZE - 1) - BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+    if(cnt > SOC_UART_FIFO_LEN)
+        cnt = SOC_UART_FIFO_LEN;
+
+    for(idx = 0; idx < cnt; idx++)
+        data[idx] = _uart_ll_read_rxfifo(uart->dev);
+
+    if(cnt)
+        uart->rx_stats.buffer_overflows += rx_buffer_enqueue(rxbuf, data, cnt, enqueue_rt);
 }
 
-static int16_t serialRead (void)
-{
-    int16_t data;
-    uint16_t bptr = rxbuffer.tail;
+// UART0
 
-    if(bptr == rxbuffer.head)
-        return -1; // no data available else EOF
+IRAM_ATTR static void _uart1_isr (void *arg)
+{
+    uart_isr(&uart1, &rxbuffer, enqueue_realtime_command);
+}
 
-    data = rxbuffer.data[bptr++];                 // Get next character, increment tmp pointer
-    rxbuffer.tail = bptr & (RX_BUFFER_SIZE - 1);  // and update pointer
+static uint16_t serialAvailable (void)
+{
+    return rx_buffer_count(&rxbuffer);
+}
 
-    return data;
+uint16_t static serialTxCount (void)
+{
+    return uart_tx_count(&uart1);
 }
 
-static bool serialPutC (const char c)
+static uint16_t serialRXFree (void)
 {
-    while(_uart_ll_get_txfifo_count(uart1.dev) == uart1.tx_len) {
-        if(!hal.stream_blocking_callback())
-            return false;
-    }
+    return rx_buffer_free(&rxbuffer);
+}
 
-    _uart_ll_write_txfifo(uart1.dev, c);
+static int16_t serialRead (void)
+{
+    return rx_buffer_getc(&rxbuffer);
+}
 
-    return true;
+static bool serialPutC (const char c)
+{
+    return uart_tx_putc(&uart1, c);
 }
 
 static void serialWriteS (const char *data)
 {
-    char c, *ptr = (char *)data;
-
-    while((c = *ptr++) != '\0')
-       serialPutC(c);
+    uart_tx_write(&uart1, data, (uint16_t)strlen(data));
 }
 
 //
@@ -481,10 +654,7 @@ static void serialWriteS (const char *data)
 //
 void static serialWrite (const char *s, uint16_t length)
 {
-    char *ptr = (char *)s;
-
-    while(length--)
-        serialPutC(*ptr++);
+    uart_tx_write(&uart1, s, length);
 }
 
 IRAM_ATTR static void serialFlush (void)
@@ -493,8 +663,7 @@ IRAM_ATTR static void serialFlush (void)
 
     _uart_flush(&uart1, false);
 
-    rxbuffer.tail = rxbuffer.head;
-    rxbuffer.overflow = Off;
+    rx_buffer_flush(&rxbuffer);
 
     UART_MUTEX_UNLOCK(&uart1);
 }
@@ -503,7 +672,7 @@ IRAM_ATTR static void serialTxFlush (void)
 {
     UART_MUTEX_LOCK(&uart1);
 
-    _uart_flush(&uart1, true);
+    uart_tx_flush(&uart1);
 
     UART_MUTEX_UNLOCK(&uart1);
 }
@@ -512,9 +681,7 @@ IRAM_ATTR static void serialCancel (void)
 {
     UART_MUTEX_LOCK(&uart1);
 
-    rxbuffer.data[rxbuffer.head] = ASCII_CAN;
-    rxbuffer.tail = rxbuffer.head;
-    rxbuffer.head = (rxbuffer.tail + 1) & (RX_BUFFER_SIZE - 1);
+    rx_buffer_cancel(&rxbuffer);
 
     UART_MUTEX_UNLOCK(&uart1);
 }
@@ -599,6 +766,7 @@ static const io_stream_t *serialInit (uint32_t baud_rate)
     serial[0].flags.claimed = On;
 
     memcpy(&uart1, &_uart_bus_array[0], sizeof(uart_t)); // use UART 0
+    uart_tx_init(&uart1, &txbuffer);
 
     uartConfig(&uart1, baud_rate);
 
@@ -612,73 +780,32 @@ static const io_stream_t *serialInit (uint32_t baud_rate)
 
 static void IRAM_ATTR _uart2_isr (void *arg)
 {
-    uint32_t c, cnt = uart_ll_get_rxfifo_len(uart2.dev), iflags = uart_ll_get_intsts_mask(uart2.dev);
-
-    uart_ll_clr_intsts_mask(uart2.dev, iflags);
-
-    if(iflags & UART_INTR_RXFIFO_OVF)
-        rxbuffer2.overflow = On;
-
-    while(cnt) {
-
-        cnt--;
-        c = _uart_ll_read_rxfifo(uart2.dev);
-
-        if(!enqueue_realtime_command2(c)) {
-
-            uint32_t bptr = (rxbuffer2.head + 1) & RX_BUFFER_SIZE_MASK;  // Get next head pointer
-
-            if(bptr == rxbuffer2.tail)                    // If buffer full
-                rxbuffer2.overflow = On;                  // flag overflow,
-            else {
-                rxbuffer2.data[rxbuffer2.head] = (char)c; // else add data to buffer
-                rxbuffer2.head = bptr;                    // and update pointer
-            }
-        }
-    }
+    uart_isr(&uart2, &rxbuffer2, enqueue_realtime_command2);
 }
 
 uint16_t static serial2Available (void)
 {
-    uint16_t head = rxbuffer2.head, tail = rxbuffer2.tail;
-
-    return BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+    return rx_buffer_count(&rxbuffer2);
 }
 
 uint16_t static serial2TxCount (void)
 {
-    return uart_ll_is_tx_idle(uart2.dev) ? 0 : (uint16_t)_uart_ll_get_txfifo_count(uart2.dev) + 1;
+    return uart_tx_count(&uart2);
 }
 
 uint16_t static serial2RXFree (void)
 {
-    uint16_t head = rxbuffer2.head, tail = rxbuffer2.tail;
-
-    return (RX_BUFFER_SIZE - 1) - BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+    return rx_buffer_free(&rxbuffer2);
 }
 
 bool static serial2PutC (const char c)
 {
-    UART_MUTEX_LOCK(&uart2);
-
-    while(_uart_ll_get_txfifo_count(uart2.dev) == uart2.tx_len) {
-        if(!hal.stream_blocking_callback())
-            return false;
-    }
-
-    _uart_ll_write_txfifo(uart2.dev, c);
-
-    UART_MUTEX_UNLOCK(&uart2);
-
-    return true;
+    return uart_tx_putc(&uart2, c);
 }
 
 void static serial2WriteS (const char *data)
 {
-    char c, *ptr = (char *)data;
-
-    while((c = *ptr++) != '\0')
-        serial2PutC(c);
+    uart_tx_write(&uart2, data, (uint16_t)strlen(data));
 }
 
 //
@@ -686,30 +813,12 @@ void static serial2WriteS (const char *data)
 //
 void static serial2Write (const char *s, uint16_t length)
 {
-    char *ptr = (char *)s;
-
-    while(length--)
-        serial2PutC(*ptr++);
+    uart_tx_write(&uart2, s, length);
 }
 
 int16_t static serial2Read (void)
 {
-    UART_MUTEX_LOCK(&uart2);
-
-    int16_t data;
-    uint16_t bptr = rxbuffer2.tail;
-
-    if(bptr == rxbuffer2.head) {
-        UART_MUTEX_UNLOCK(&uart2);
-        return -1; // no data available else EOF
-    }
-
-    data = rxbuffer2.data[bptr++];                 // Get next character, increment tmp pointer
-    rxbuffer2.tail = bptr & (RX_BUFFER_SIZE - 1);  // and update pointer
-
-    UART_MUTEX_UNLOCK(&uart2);
-
-    return data;
+    return rx_buffer_getc(&rxbuffer2);
 }
 
 IRAM_ATTR static void serial2Flush (void)
@@ -718,8 +827,7 @@ IRAM_ATTR static void serial2Flush (void)
 
     _uart_flush(&uart2, false);
 
-    rxbuffer2.tail = rxbuffer2.head;
-    rxbuffer2.overflow = Off;
+    rx_buffer_flush(&rxbuffer2);
 
     UART_MUTEX_UNLOCK(&uart2);
 }
@@ -728,7 +836,7 @@ IRAM_ATTR static void serial2TxFlush (void)
 {
     UART_MUTEX_LOCK(&uart2);
 
-    _uart_flush(&uart2, true);
+    uart_tx_flush(&uart2);
 
     UART_MUTEX_UNLOCK(&uart2);
 }
@@ -737,9 +845,7 @@ IRAM_ATTR static void serial2Cancel (void)
 {
     UART_MUTEX_LOCK(&uart2);
 
-    rxbuffer2.data[rxbuffer2.head] = ASCII_CAN;
-    rxbuffer2.tail = rxbuffer2.head;
-    rxbuffer2.head = (rxbuffer2.tail + 1) & (RX_BUFFER_SIZE - 1);
+    rx_buffer_cancel(&rxbuffer2);
 
     UART_MUTEX_UNLOCK(&uart2);
 }
@@ -827,6 +933,7 @@ static const io_stream_t *serial2Init (uint32_t baud_rate)
     serial[1].flags.claimed = On;
 
     memcpy(&uart2, &_uart_bus_array[1], sizeof(uart_t)); // use UART 1
+    uart_tx_init(&uart2, &txbuffer2);
 
     uartConfig(&uart2, baud_rate);
 
@@ -846,73 +953,32 @@ static const io_stream_t *serial2Init (uint32_t baud_rate)
 
 static void IRAM_ATTR _uart3_isr (void *arg)
 {
-    uint32_t c, cnt = uart_ll_get_rxfifo_len(uart3.dev), iflags = uart_ll_get_intsts_mask(uart3.dev);
-
-    uart_ll_clr_intsts_mask(uart3.dev, iflags);
-
-    if(iflags & UART_INTR_RXFIFO_OVF)
-        rxbuffer3.overflow = On;
-
-    while(cnt) {
-
-        cnt--;
-        c = _uart_ll_read_rxfifo(uart3.dev);
-
-        if(!enqueue_realtime_command3(c)) {
-
-            uint32_t bptr = (rxbuffer3.head + 1) & RX_BUFFER_SIZE_MASK;  // Get next head pointer
-
-            if(bptr == rxbuffer3.tail)                    // If buffer full
-                rxbuffer3.overflow = On;                  // flag overflow,
-            else {
-                rxbuffer3.data[rxbuffer3.head] = (char)c; // else add data to buffer
-                rxbuffer3.head = bptr;                    // and update pointer
-            }
-        }
-    }
+    uart_isr(&uart3, &rxbuffer3, enqueue_realtime_command3);
 }
 
 uint16_t static serial3Available (void)
 {
-    uint16_t head = rxbuffer3.head, tail = rxbuffer3.tail;
-
-    return BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+    return rx_buffer_count(&rxbuffer3);
 }
 
 uint16_t static serial3TxCount (void)
 {
-    return uart_ll_is_tx_idle(uart3.dev) ? 0 : (uint16_t)_uart_ll_get_txfifo_count(uart3.dev) + 1;
+    return uart_tx_count(&uart3);
 }
 
 uint16_t static serial3RXFree (void)
 {
-    uint16_t head = rxbuffer3.head, tail = rxbuffer3.tail;
-
-    return (RX_BUFFER_SIZE - 1) - BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+    return rx_buffer_free(&rxbuffer3);
 }
 
 bool static serial3PutC (const char c)
 {
-    UART_MUTEX_LOCK(&uart3);
-    serialPutC(c);
-    while(_uart_ll_get_txfifo_count(uart3.dev) == uart3.tx_len) {
-        if(!hal.stream_blocking_callback())
-            return false;
-    }
-
-    _uart_ll_write_txfifo(uart3.dev, c);
-
-    UART_MUTEX_UNLOCK(&uart3);
-
-    return true;
+    return uart_tx_putc(&uart3, c);
 }
 
 void static serial3WriteS (const char *data)
 {
-    char c, *ptr = (char *)data;
-
-    while((c = *ptr++) != '\0')
-        serial3PutC(c);
+    uart_tx_write(&uart3, data, (uint16_t)strlen(data));
 }
 
 //
@@ -920,30 +986,12 @@ void static serial3WriteS (const char *data)
 //
 void static serial3Write (const char *s, uint16_t length)
 {
-    char *ptr = (char *)s;
-
-    while(length--)
-        serial3PutC(*ptr++);
+    uart_tx_write(&uart3, s, length);
 }
 
 int16_t static serial3Read (void)
 {
-    UART_MUTEX_LOCK(&uart3);
-
-    int16_t data;
-    uint16_t bptr = rxbuffer3.tail;
-
-    if(bptr == rxbuffer3.head) {
-        UART_MUTEX_UNLOCK(&uart3);
-        return -1; // no data available else EOF
-    }
-
-    data = rxbuffer3.data[bptr++];                 // Get next character, increment tmp pointer
-    rxbuffer3.tail = bptr & (RX_BUFFER_SIZE - 1);  // and update pointer
-
-    UART_MUTEX_UNLOCK(&uart3);
-
-    return data;
+    return rx_buffer_getc(&rxbuffer3);
 }
 
 IRAM_ATTR static void serial3Flush (void)
@@ -952,8 +1000,7 @@ IRAM_ATTR static void serial3Flush (void)
 
     _uart_flush(&uart3, false);
 
-    rxbuffer3.tail = rxbuffer3.head;
-    rxbuffer3.overflow = Off;
+    rx_buffer_flush(&rxbuffer3);
 
     UART_MUTEX_UNLOCK(&uart3);
 }
@@ -962,7 +1009,7 @@ IRAM_ATTR static void serial3TxFlush (void)
 {
     UART_MUTEX_LOCK(&uart3);
 
-    _uart_flush(&uart3, true);
+    uart_tx_flush(&uart3);
 
     UART_MUTEX_UNLOCK(&uart3);
 }
@@ -971,9 +1018,7 @@ IRAM_ATTR static void serial3Cancel (void)
 {
     UART_MUTEX_LOCK(&uart3);
 
-    rxbuffer3.data[rxbuffer3.head] = ASCII_CAN;
-    rxbuffer3.tail = rxbuffer3.head;
-    rxbuffer3.head = (rxbuffer3.tail + 1) & (RX_BUFFER_SIZE - 1);
+    rx_buffer_cancel(&rxbuffer3);
 
     UART_MUTEX_UNLOCK(&uart3);
 }
@@ -1061,6 +1106,7 @@ static const io_stream_t *serial3Init (uint32_t baud_rate)
     serial[2].flags.claimed = On;
 
     memcpy(&uart3, &_uart_bus_array[2], sizeof(uart_t)); // use UART 2
+    uart_tx_init(&uart3, &txbuffer3);
 
     uartConfig(&uart3, baud_rate);
 
@@ -1075,3 +1121,34 @@ static const io_stream_t *serial3Init (uint32_t baud_rate)
 }
 
 #endif // SERIAL3_ENABLE
+
+// Claimed streams may be copies, so the buffer is looked up from the read function.
+static stream_rx_buffer_t *serialGetRxBuffer (const io_stream_t *stream)
+{
+    if(stream->read == serialRead)
+        return &rxbuffer;
+#if SERIAL2_ENABLE
+    if(stream->read == serial2Read)
+        return &rxbuffer2;
+#endif
+#if SERIAL3_ENABLE
+    if(stream->read == serial3Read)
+        return &rxbuffer3;
+#endif
+
+    return NULL;
+}
+
+uint16_t serialReadN (const io_stream_t *stream, char *dst, uint16_t max)
+{
+    stream_rx_buffer_t *rxbuf = serialGetRxBuffer(stream);
+
+    return rxbuf ? rx_buffer_read_n(rxbuf, dst, max) : 0;
+}
+
+uint16_t serialReadLine (const io_stream_t *stream, char *dst, uint16_t max)
+{
+    stream_rx_buffer_t *rxbuf = serialGetRxBuffer(stream);
+
+    return rxbuf ? rx_buffer_read_line(rxbuf, dst, max) : 0;
+}
@@ -24,6 +24,13 @@
 #ifndef _UART_SERIAL_H_
 #define _UART_SERIAL_H_
 
+#include "grbl/stream.h"
+
 void serialRegisterStreams (void);
 
+// Bulk reads from a claimed serial stream, for plugins consuming blocks or lines rather than characters.
+// Returns the number of characters read, 0 if the stream is not a serial stream.
+uint16_t serialReadN (const io_stream_t *stream, char *dst, uint16_t max);
+uint16_t serialReadLine (const io_stream_t *stream, char *dst, uint16_t max);
+
 #endif
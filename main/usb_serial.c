@@ -31,6 +31,7 @@
 
 #include <stdint.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "tinyusb.h"
@@ -41,13 +42,19 @@
 
 #include "usb_serial.h"
 #include "driver.h"
+#include "stream_buffer.h"
 #include "grbl/protocol.h"
 
 //#if USB_SERIAL_CDC == 2
 
 #define BLOCK_RX_BUFFER_SIZE 20
 
-static stream_block_tx_buffer_t txbuf = {0};
+#ifndef USB_TX_FLUSH_US
+#define USB_TX_FLUSH_US 500 // partial packets are sent after this delay unless a line end is written
+#endif
+
+static volatile bool flush_pending = false;
+static esp_timer_handle_t flush_timer = NULL;
 static stream_rx_buffer_t rxbuf;
 static volatile enqueue_realtime_command_ptr enqueue_realtime_command = protocol_enqueue_realtime_command;
 
@@ -61,22 +68,51 @@ static bool usb_is_connected(void)
     return tud_cdc_n_connected(0);
 }
 
-static void usb_out_chars (const char *buf, int length)
+static void usb_tx_flush (void *arg)
+{
+    flush_pending = false;
+
+    if(usb_connected())
+        tud_cdc_n_write_flush(TINYUSB_USBDEV_0);
+}
+
+// Output is copied straight to the TinyUSB TX FIFO which sends full packets as they become
+// available. Partial packets are sent on line end or by the flush timer.
+static bool usb_out_chars (const char *buf, uint32_t length)
 {
-    if(usb_connected()) {
-        for(int i = 0; i < length;) {
-        	size_t n = length - i;
-        	uint32_t avail = tud_cdc_n_write_available(TINYUSB_USBDEV_0);
-            if(n > avail)
-                n = avail;
-            if(n) {
-                size_t n2 = tinyusb_cdcacm_write_queue(TINYUSB_USBDEV_0, (uint8_t *)buf + i, n);
-                tinyusb_cdcacm_write_flush(TINYUSB_USBDEV_0, 2);
-                i += n2;
-            } else if(tinyusb_cdcacm_write_flush(TINYUSB_USBDEV_0, 2) == ESP_ERR_TIMEOUT)
-                break;
+    uint32_t n;
+
+    if(length == 0)
+        return true;
+
+    if(!usb_connected())
+        return false;
+
+    while(length) {
+        if((n = tud_cdc_n_write_available(TINYUSB_USBDEV_0)) > 0) {
+            n = tud_cdc_n_write(TINYUSB_USBDEV_0, buf, n > length ? length : n);
+            buf += n;
+            length -= n;
+        } else {
+            tud_cdc_n_write_flush(TINYUSB_USBDEV_0);
+            // Drop output if the host has closed the port, else wait for space
+            if(!(tud_cdc_n_connected(TINYUSB_USBDEV_0) && hal.stream_blocking_callback()))
+                return false;
         }
     }
+
+    if(buf[-1] == ASCII_LF) {
+        if(flush_pending) {
+            esp_timer_stop(flush_timer);
+            flush_pending = false;
+        }
+        tud_cdc_n_write_flush(TINYUSB_USBDEV_0);
+    } else if(!flush_pending) {
+        flush_pending = true;
+        esp_timer_start_once(flush_timer, USB_TX_FLUSH_US);
+    }
+
+    return true;
 }
 
 /*
@@ -96,9 +132,7 @@ static int32_t usb_in_chars (char *buf, uint32_t length)
 //
 static uint16_t usb_serialRxCount (void)
 {
-    uint_fast16_t tail = rxbuf.tail, head = rxbuf.head;
-
-    return (uint16_t)BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+    return rx_buffer_count(&rxbuf);
 }
 
 //
@@ -106,9 +140,7 @@ static uint16_t usb_serialRxCount (void)
 //
 static uint16_t usb_serialRxFree (void)
 {
-    uint_fast16_t tail = rxbuf.tail, head = rxbuf.head;
- 
-    return (uint16_t)((RX_BUFFER_SIZE - 1) - BUFCOUNT(head, tail, RX_BUFFER_SIZE));
+    return rx_buffer_free(&rxbuf);
 }
 
 //
@@ -117,7 +149,7 @@ static uint16_t usb_serialRxFree (void)
 static void usb_serialRxFlush (void)
 {
   //  usb_serial_flush_input();
-    rxbuf.tail = rxbuf.head;
+    rx_buffer_flush(&rxbuf);
 }
 
 //
@@ -125,9 +157,7 @@ static void usb_serialRxFlush (void)
 //
 static void usb_serialRxCancel (void)
 {
-    rxbuf.data[rxbuf.head] = CMD_RESET;
-    rxbuf.tail = rxbuf.head;
-    rxbuf.head = BUFNEXT(rxbuf.head, rxbuf);
+    rx_buffer_cancel(&rxbuf);
 }
 
 //
@@ -135,40 +165,7 @@ static void usb_serialRxCancel (void)
 //
 static bool usb_serialPutC (const char c)
 {
-    static char buf[1];
-
-    *buf = c;
-    usb_out_chars(buf, 1);
-
-    return true;
-}
-
-bool _usb_write (void)
-{
-    size_t txfree, length;
-
-    txbuf.s = txbuf.data;
-
-    while(txbuf.length) {
-
-        if((txfree = tud_cdc_write_available()) > 10) {
-
-            length = txfree < txbuf.length ? txfree : txbuf.length;
-
-            usb_out_chars(txbuf.s, length); //
-
-            txbuf.length -= length;
-            txbuf.s += length;
-        }
-
-        if(txbuf.length && !hal.stream_blocking_callback()) {
-            txbuf.length = 0;
-            txbuf.s = txbuf.data;
-            return false;
-        }
-    }
-
-    txbuf.s = txbuf.data;
+    usb_out_chars(&c, 1);
 
     return true;
 }
@@ -178,10 +175,6 @@ bool _usb_write (void)
 //
 static void usb_serialWrite (const char *s, uint16_t length)
 {
-    // Empty buffer first...
-    if(txbuf.length && !_usb_write())
-        return;
-
     usb_out_chars(s, length);
 }
 
@@ -190,23 +183,7 @@ static void usb_serialWrite (const char *s, uint16_t length)
 //
 static void usb_serialWriteS (const char *s)
 {
-    if(*s == '\0')
-        return;
-
-    size_t length = strlen(s);
-
-    if((length + txbuf.length) < BLOCK_TX_BUFFER_SIZE) {
-
-        memcpy(txbuf.s, s, length);
-        txbuf.length += length;
-        txbuf.s += length;
-
-        if(s[length - 1] == ASCII_LF || txbuf.length > txbuf.max_length) {
-            if(!_usb_write())
-                return;
-        }
-    } else
-        usb_serialWrite(s, length);
+    usb_out_chars(s, strlen(s));
 }
 
 //
@@ -214,15 +191,7 @@ static void usb_serialWriteS (const char *s)
 //
 static int16_t usb_serialGetC (void)
 {
-    uint_fast16_t tail = rxbuf.tail;
-
-    if(tail == rxbuf.head)
-        return -1; // no data available
-
-    char data = rxbuf.data[tail];       // Get next character, increment tmp pointer
-    rxbuf.tail = BUFNEXT(tail, rxbuf); // and update pointer
-
-    return (int16_t)data;
+    return rx_buffer_getc(&rxbuf);
 }
 
 static bool usb_serialSuspendInput (bool suspend)
@@ -249,26 +218,12 @@ static void usb_rx_callback (int itf, cdcacm_event_t *event)
 {
     static uint8_t tmpbuf[CONFIG_TINYUSB_CDC_RX_BUFSIZE];
 
-    uint8_t c, *dp;
     size_t avail, free;
 
-	dp = tmpbuf;
-	free = (int32_t)usb_serialRxFree();
-	free = free > CONFIG_TINYUSB_CDC_RX_BUFSIZE ? CONFIG_TINYUSB_CDC_RX_BUFSIZE : free;
-	if(tinyusb_cdcacm_read(itf, tmpbuf, free, &avail) == ESP_OK) {
-        if(avail > 0) while(avail--) {
-            c = *dp++;
-            if(!enqueue_realtime_command(c)) {
-                uint_fast16_t next_head = BUFNEXT(rxbuf.head, rxbuf);   // Get next head pointer
-                if(next_head == rxbuf.tail)                             // If buffer full
-                    rxbuf.overflow = On;                                // flag overflow,
-                else {
-                    rxbuf.data[rxbuf.head] = c;                         // else add character data to buffer
-                    rxbuf.head = next_head;                             // and update pointer
-                }
-            }
-        }
-	}
+    free = (int32_t)usb_serialRxFree();
+    free = free > CONFIG_TINYUSB_CDC_RX_BUFSIZE ? CONFIG_TINYUSB_CDC_RX_BUFSIZE : free;
+    if(tinyusb_cdcacm_read(itf, tmpbuf, free, &avail) == ESP_OK && avail > 0)
+        rx_buffer_enqueue(&rxbuf, tmpbuf, avail, enqueue_realtime_command);
 }
 
 const io_stream_t *usb_serialInit (void)
@@ -304,9 +259,13 @@ const io_stream_t *usb_serialInit (void)
     tinyusb_driver_install(&tusb_cfg);
     tusb_cdc_acm_init(&acm_cfg);
 
-    txbuf.s = txbuf.data;
-    txbuf.max_length = CFG_TUD_CDC_TX_BUFSIZE;
-    txbuf.max_length = (txbuf.max_length > BLOCK_TX_BUFFER_SIZE ? BLOCK_TX_BUFFER_SIZE : txbuf.max_length) - 20;
+    esp_timer_create_args_t flush_timer_args = {
+        .callback = usb_tx_flush,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "usb tx flush"
+    };
+
+    esp_timer_create(&flush_timer_args, &flush_timer);
 
     return &stream;
 }
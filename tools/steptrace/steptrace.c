@@ -0,0 +1,178 @@
+/*
+
+  steptrace.c - host side decoder for the ESP32 driver step output trace
+
+  Reads the output of $STEPTRACE=D (STEP_TRACE_ENABLE builds) from a file or stdin and
+  reports achieved step rates, direction change to step timing and pulse_start cost.
+
+  Usage: steptrace [-f <step timer Hz>] [-c <CPU Hz>] [file]
+
+  NOTE: this is not a simulator, the trace has to be captured on hardware. driver.c is not built
+        for the host against a mocked GPIO/RMT/TIMERG0 layer as it depends on ESP-IDF and the core.
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define N_AXIS_MAX 8
+
+// One logged event, see step_trace_dump() in main/driver.c:
+// [STEP:<ticks>,<ccount>,<step bits>,<dir bits>,<dir changed>,<cycles>]
+typedef struct {
+    uint32_t ticks;
+    uint32_t ccount;
+    uint32_t step;
+    uint32_t dir;
+    uint32_t dir_change;
+    uint32_t cycles;
+} event_t;
+
+typedef struct {
+    uint32_t steps;
+    uint32_t first;
+    uint32_t last;
+    uint32_t min_delta;
+    uint32_t dir_changes;
+    uint32_t dir_pending;       // timeline position of last direction change, valid if dir_wait
+    bool dir_wait;
+    uint32_t min_dir_to_step;
+} axis_t;
+
+static bool parse_event (const char *line, event_t *event)
+{
+    return sscanf(line, "[STEP:%u,%u,%u,%u,%u,%u]", &event->ticks, &event->ccount, &event->step,
+                   &event->dir, &event->dir_change, &event->cycles) == 6;
+}
+
+int main (int argc, char **argv)
+{
+    char line[256];
+    double f_step_timer = 20e6, f_cpu = 240e6;
+    FILE *in = stdin;
+    axis_t axis[N_AXIS_MAX];
+    event_t event, prev = {0};
+    uint32_t idx, n_events = 0, isr_min = UINT32_MAX, isr_max = 0;
+    uint64_t isr_total = 0;
+    double jitter, jitter_max = 0.0;
+
+    for(idx = 1; idx < (uint32_t)argc; idx++) {
+        if(!strcmp(argv[idx], "-f") && idx + 1 < (uint32_t)argc)
+            f_step_timer = atof(argv[++idx]);
+        else if(!strcmp(argv[idx], "-c") && idx + 1 < (uint32_t)argc)
+            f_cpu = atof(argv[++idx]);
+        else if((in = fopen(argv[idx], "r")) == NULL) {
+            perror(argv[idx]);
+            return 1;
+        }
+    }
+
+    memset(axis, 0, sizeof(axis));
+    for(idx = 0; idx < N_AXIS_MAX; idx++)
+        axis[idx].min_delta = axis[idx].min_dir_to_step = UINT32_MAX;
+
+    while(fgets(line, sizeof(line), in)) {
+
+        if(!parse_event(line, &event))
+            continue;
+
+        for(idx = 0; idx < N_AXIS_MAX; idx++) {
+
+            axis_t *a = &axis[idx];
+
+            if(event.dir_change && ((event.dir ^ prev.dir) & (1 << idx))) {
+                a->dir_changes++;
+                a->dir_pending = event.ticks;
+                a->dir_wait = true;
+            }
+
+            if(event.step & (1 << idx)) {
+                if(a->steps++ == 0)
+                    a->first = event.ticks;
+                else if(event.ticks - a->last < a->min_delta)
+                    a->min_delta = event.ticks - a->last;
+                a->last = event.ticks;
+                if(a->dir_wait) {
+                    if(event.ticks - a->dir_pending < a->min_dir_to_step)
+                        a->min_dir_to_step = event.ticks - a->dir_pending;
+                    a->dir_wait = false;
+                }
+            }
+        }
+
+        // Deviation of the actual interrupt timing from the programmed timeline
+        if(n_events) {
+            jitter = (double)(int32_t)((event.ccount - prev.ccount) - (uint32_t)((double)(event.ticks - prev.ticks) * f_cpu / f_step_timer)) / f_cpu * 1e6;
+            if(jitter < 0.0)
+                jitter = -jitter;
+            if(jitter > jitter_max)
+                jitter_max = jitter;
+        }
+
+        if(event.cycles < isr_min)
+            isr_min = event.cycles;
+        if(event.cycles > isr_max)
+            isr_max = event.cycles;
+        isr_total += event.cycles;
+
+        prev = event;
+        n_events++;
+    }
+
+    if(in != stdin)
+        fclose(in);
+
+    if(n_events == 0) {
+        fprintf(stderr, "no [STEP:...] events found\n");
+        return 1;
+    }
+
+    printf("events: %u\n", n_events);
+    printf("pulse_start cycles: min %u, avg %.0f, max %u (max %.2f us)\n", isr_min, (double)isr_total / n_events, isr_max, (double)isr_max / f_cpu * 1e6);
+    printf("max timing deviation: %.2f us\n", jitter_max);
+
+    for(idx = 0; idx < N_AXIS_MAX; idx++) {
+
+        axis_t *a = &axis[idx];
+
+        if(a->steps == 0 && a->dir_changes == 0)
+            continue;
+
+        printf("axis %u: %u steps", idx, a->steps);
+        if(a->steps > 1) {
+            printf(", peak %.0f steps/s", f_step_timer / a->min_delta);
+            if(a->last != a->first)
+                printf(", average %.0f steps/s", (double)(a->steps - 1) * f_step_timer / (double)(a->last - a->first));
+        }
+        printf(", %u direction changes", a->dir_changes);
+        if(a->min_dir_to_step != UINT32_MAX) {
+            if(a->min_dir_to_step)
+                printf(", min direction change to step %.2f us", (double)a->min_dir_to_step / f_step_timer * 1e6);
+            else
+                printf(", step in direction change tick (setup time set by $29)");
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+
+  pcnt_count_test.c - host unit test of the encoder count arithmetic
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <math.h>
+
+#include "pcnt_count.h"
+
+static int failed = 0;
+
+#define CHECK(cond) if(!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+// Models the hardware counter and the interrupt handler, the counter is cleared on reaching a limit
+// and the limit event latched until the interrupt is handled.
+typedef struct {
+    int32_t accumulated;
+    int16_t count;
+    bool pending;
+    uint32_t status;
+} counter_t;
+
+static void counter_step (counter_t *c, int dir)
+{
+    c->count += dir;
+    if(c->count == PCNT_ENCODER_LIMIT || c->count == -PCNT_ENCODER_LIMIT) {
+        c->status = c->count > 0 ? PCNT_COUNT_STATUS_H_LIM : PCNT_COUNT_STATUS_L_LIM;
+        c->pending = true;
+        c->count = 0;
+    }
+}
+
+static void counter_isr (counter_t *c)
+{
+    if(c->pending) {
+        c->accumulated += pcnt_count_limit_event(c->status);
+        c->pending = false;
+    }
+}
+
+static int32_t counter_read (counter_t *c)
+{
+    return pcnt_count_combine(c->accumulated, c->count, c->pending, c->status);
+}
+
+static void test_limit_event (void)
+{
+    CHECK(pcnt_count_limit_event(0) == 0);
+    CHECK(pcnt_count_limit_event(PCNT_COUNT_STATUS_H_LIM) == PCNT_ENCODER_LIMIT);
+    CHECK(pcnt_count_limit_event(PCNT_COUNT_STATUS_L_LIM) == -PCNT_ENCODER_LIMIT);
+    CHECK(pcnt_count_limit_event(0x40) == 0);   // zero event
+}
+
+static void test_combine (void)
+{
+    CHECK(pcnt_count_combine(0, 123, false, 0) == 123);
+    CHECK(pcnt_count_combine(2 * PCNT_ENCODER_LIMIT, -5, false, PCNT_COUNT_STATUS_H_LIM) == 2 * PCNT_ENCODER_LIMIT - 5);
+    // Wrap raised but not yet handled, the counter has been cleared.
+    CHECK(pcnt_count_combine(0, 0, true, PCNT_COUNT_STATUS_H_LIM) == PCNT_ENCODER_LIMIT);
+    CHECK(pcnt_count_combine(0, 3, true, PCNT_COUNT_STATUS_H_LIM) == PCNT_ENCODER_LIMIT + 3);
+    CHECK(pcnt_count_combine(-PCNT_ENCODER_LIMIT, -2, true, PCNT_COUNT_STATUS_L_LIM) == -2 * PCNT_ENCODER_LIMIT - 2);
+    // Accumulated count wraps around the 32 bit range.
+    CHECK(pcnt_count_combine(INT32_MAX, 1, false, 0) == INT32_MIN);
+}
+
+// The count must be monotonic while stepping across the limits, with the interrupt handled late or not at all.
+static void test_wrap (void)
+{
+    int dir, i;
+
+    for(dir = -1; dir <= 1; dir += 2) {
+
+        counter_t c = {0};
+        int32_t expected = 0;
+
+        for(i = 0; i < 5 * PCNT_ENCODER_LIMIT; i++) {
+            counter_step(&c, dir);
+            expected += dir;
+            CHECK(counter_read(&c) == expected);
+            if(i % 1000 == 999)
+                counter_isr(&c);
+            CHECK(counter_read(&c) == expected);
+            if(failed)
+                return;
+        }
+    }
+}
+
+static void test_index (void)
+{
+    CHECK(!pcnt_count_index_error(1000, 0, 1000, 1));
+    CHECK(!pcnt_count_index_error(-1000, 0, 1000, 1));
+    CHECK(!pcnt_count_index_error(1001, 0, 1000, 1));
+    CHECK(pcnt_count_index_error(1002, 0, 1000, 1));
+    CHECK(pcnt_count_index_error(998, 0, 1000, 1));
+    CHECK(!pcnt_count_index_error(INT32_MIN + 499, INT32_MAX - 500, 1000, 1));
+}
+
+static void test_angular_position (void)
+{
+    CHECK(fabsf(pcnt_count_angular_position(3, 250, 0, 1.0f / 1000.0f) - 3.25f) < 1e-5f);
+    CHECK(fabsf(pcnt_count_angular_position(3, -250, 0, 1.0f / 1000.0f) - 3.25f) < 1e-5f);
+    CHECK(fabsf(pcnt_count_angular_position(1, INT32_MIN + 99, INT32_MAX - 400, 1.0f / 1000.0f) - 1.5f) < 1e-5f);
+}
+
+int main (void)
+{
+    test_limit_event();
+    test_combine();
+    test_wrap();
+    test_index();
+    test_angular_position();
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}